@@ -76,11 +76,27 @@ mxt_read_reg(PATMEL_CONTEXT  devContext, uint16_t reg, void *rbuf, int bytes)
 
 	uint16_t nreg = ((uint16_t *)wreg)[0];
 
-	NTSTATUS error = SpbReadDataSynchronously16(&devContext->I2CContext, nreg, rbuf, bytes);
+	NTSTATUS error = SpbReadDataSynchronously16(&devContext->I2CContext, nreg, rbuf, bytes,
+		SpbPriorityBackground);
 
 	return error;
 }
 
+/*
+* Message drains (T44/T5) take the bus ahead of config and diagnostic
+* traffic so that touch reports never queue behind a slow write.
+*/
+static NTSTATUS
+mxt_read_msg(PATMEL_CONTEXT  devContext, uint16_t reg, void *rbuf, int bytes)
+{
+	/* only T5 reads return a CRC per message */
+	if (devContext->MessageCrc && reg == devContext->T5_address)
+		reg |= MXT_T5_CRC_READ;
+
+	return SpbReadDataSynchronously16(&devContext->I2CContext, reg, rbuf, bytes,
+		SpbPriorityMessage);
+}
+
 static NTSTATUS
 mxt_write_reg_buf(PATMEL_CONTEXT  devContext, uint16_t reg, void *xbuf, int bytes)
 {
@@ -98,6 +114,114 @@ mxt_write_reg(PATMEL_CONTEXT  devContext, uint16_t reg, uint8_t val)
 	return mxt_write_reg_buf(devContext, reg, &val, 1);
 }
 
+/*
+* Write batches collect byte writes to a single object and flush them as
+* the fewest bus transactions. Runs separated by a gap of at most
+* MXT_BATCH_MAX_GAP bytes are merged when the caller supplies a shadow
+* of the object's current contents to fill the gap with.
+*/
+#define MXT_BATCH_MAX_BYTES	64
+#define MXT_BATCH_MAX_GAP	4
+
+struct mxt_write_batch {
+	uint16_t base;
+	uint8_t size;
+	uint8_t *shadow;	/* current object contents, may be NULL */
+	uint8_t data[MXT_BATCH_MAX_BYTES];
+	uint8_t dirty[MXT_BATCH_MAX_BYTES / 8];
+};
+
+static void
+mxt_batch_init(struct mxt_write_batch *batch, struct mxt_object *obj,
+	uint8_t *shadow, size_t shadow_size)
+{
+	size_t size = mxt_obj_size(obj);
+
+	if (shadow != NULL && shadow_size < size)
+		size = shadow_size;
+
+	RtlZeroMemory(batch, sizeof(*batch));
+	batch->base = obj->start_address;
+	batch->size = (uint8_t)(size > MXT_BATCH_MAX_BYTES ? MXT_BATCH_MAX_BYTES : size);
+	batch->shadow = shadow;
+}
+
+static bool
+mxt_batch_is_dirty(struct mxt_write_batch *batch, int offset)
+{
+	return (batch->dirty[offset >> 3] & (1 << (offset & 7))) != 0;
+}
+
+static NTSTATUS
+mxt_batch_write_buf(struct mxt_write_batch *batch, int offset, const void *buf, int bytes)
+{
+	const uint8_t *src = (const uint8_t *)buf;
+
+	if (offset < 0 || offset + bytes > batch->size)
+		return STATUS_INVALID_PARAMETER;
+
+	for (int i = 0; i < bytes; i++) {
+		batch->data[offset + i] = src[i];
+		batch->dirty[(offset + i) >> 3] |= 1 << ((offset + i) & 7);
+	}
+	return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+mxt_batch_write(struct mxt_write_batch *batch, int offset, uint8_t val)
+{
+	return mxt_batch_write_buf(batch, offset, &val, 1);
+}
+
+static NTSTATUS
+mxt_batch_commit(PATMEL_CONTEXT devContext, struct mxt_write_batch *batch)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	int start, end, next;
+
+	start = 0;
+	while (start < batch->size) {
+		if (!mxt_batch_is_dirty(batch, start)) {
+			start++;
+			continue;
+		}
+
+		/* extend the run, bridging short gaps from the shadow */
+		end = start + 1;
+		for (;;) {
+			while (end < batch->size && mxt_batch_is_dirty(batch, end))
+				end++;
+
+			if (batch->shadow == NULL)
+				break;
+
+			next = end;
+			while (next < batch->size && next - end < MXT_BATCH_MAX_GAP &&
+				!mxt_batch_is_dirty(batch, next))
+				next++;
+
+			if (next >= batch->size || !mxt_batch_is_dirty(batch, next))
+				break;
+
+			for (; end < next; end++)
+				batch->data[end] = batch->shadow[end];
+		}
+
+		status = mxt_write_reg_buf(devContext, batch->base + start,
+			&batch->data[start], end - start);
+		if (!NT_SUCCESS(status))
+			return status;
+
+		if (batch->shadow != NULL)
+			RtlCopyMemory(&batch->shadow[start], &batch->data[start], end - start);
+
+		start = end;
+	}
+
+	RtlZeroMemory(batch->dirty, sizeof(batch->dirty));
+	return status;
+}
+
 static NTSTATUS
 mxt_write_object_off(PATMEL_CONTEXT  devContext, struct mxt_object *obj,
 	int offset, uint8_t val)
@@ -115,7 +239,32 @@ atmel_reset_device(PATMEL_CONTEXT  devContext)
 	return mxt_write_object_off(devContext, devContext->cmdprocobj, MXT_CMDPROC_RESET_OFF, 1);
 }
 
-static NTSTATUS mxt_read_t9_resolution(PATMEL_CONTEXT devContext)
+/*
+* The controller NAKs the first transaction after deep sleep while it
+* wakes up. Issue a throwaway read of the info block so that the first
+* real drain after resume does not land on the NAK.
+*/
+static NTSTATUS
+mxt_wake(PATMEL_CONTEXT devContext)
+{
+	uint8_t family;
+
+	return mxt_read_reg(devContext, 0, &family, sizeof(family));
+}
+
+/*
+* Touch object ranges and T100 aux layout, read in full before any of it
+* replaces what the decoder is using.
+*/
+struct mxt_touch_geometry {
+	uint16_t max_x;
+	uint16_t max_y;
+	uint8_t t100_aux_vect;
+	uint8_t t100_aux_ampl;
+	uint8_t t100_aux_area;
+};
+
+static NTSTATUS mxt_read_t9_resolution(PATMEL_CONTEXT devContext, struct mxt_touch_geometry *geo)
 {
 	struct t9_range range;
 	UINT8 xsize, ysize;
@@ -153,18 +302,18 @@ static NTSTATUS mxt_read_t9_resolution(PATMEL_CONTEXT devContext)
 		range.y = 1023;
 
 	if (orient & MXT_T9_ORIENT_SWITCH) {
-		devContext->max_x = range.y + 1;
-		devContext->max_y = range.x + 1;
+		geo->max_x = range.y + 1;
+		geo->max_y = range.x + 1;
 	}
 	else {
-		devContext->max_x = range.x + 1;
-		devContext->max_y = range.y + 1;
+		geo->max_x = range.x + 1;
+		geo->max_y = range.y + 1;
 	}
-	AtmelPrint(DEBUG_LEVEL_INFO, DBG_PNP, "Screen Size: X: %d Y: %d\n", devContext->max_x, devContext->max_y);
+	AtmelPrint(DEBUG_LEVEL_INFO, DBG_PNP, "Screen Size: X: %d Y: %d\n", geo->max_x, geo->max_y);
 	return status;
 }
 
-static NTSTATUS mxt_read_t100_config(PATMEL_CONTEXT devContext)
+static NTSTATUS mxt_read_t100_config(PATMEL_CONTEXT devContext, struct mxt_touch_geometry *geo)
 {
 	NTSTATUS status;
 	uint16_t range_x, range_y;
@@ -192,12 +341,12 @@ static NTSTATUS mxt_read_t100_config(PATMEL_CONTEXT devContext)
 	}
 
 	if (cfg & MXT_T100_CFG_SWITCHXY) {
-		devContext->max_x = range_y + 1;
-		devContext->max_y = range_x + 1;
+		geo->max_x = range_y + 1;
+		geo->max_y = range_x + 1;
 	}
 	else {
-		devContext->max_x = range_x + 1;
-		devContext->max_y = range_y + 1;
+		geo->max_x = range_x + 1;
+		geo->max_y = range_y + 1;
 	}
 
 	status = mxt_read_reg(devContext, resolutionobject->start_address + MXT_T100_TCHAUX, &tchaux, 1);
@@ -205,38 +354,139 @@ static NTSTATUS mxt_read_t100_config(PATMEL_CONTEXT devContext)
 		return status;
 	}
 
+	/* a reread after a config change may have dropped fields */
+	geo->t100_aux_vect = 0;
+	geo->t100_aux_ampl = 0;
+	geo->t100_aux_area = 0;
+
 	aux = 6;
 
 	if (tchaux & MXT_T100_TCHAUX_VECT)
-		devContext->t100_aux_vect = aux++;
+		geo->t100_aux_vect = aux++;
 
 	if (tchaux & MXT_T100_TCHAUX_AMPL)
-		devContext->t100_aux_ampl = aux++;
+		geo->t100_aux_ampl = aux++;
 
 	if (tchaux & MXT_T100_TCHAUX_AREA)
-		devContext->t100_aux_area = aux++;
-	AtmelPrint(DEBUG_LEVEL_INFO, DBG_PNP, "Screen Size T100: X: %d Y: %d\n", devContext->max_x, devContext->max_y);
+		geo->t100_aux_area = aux++;
+	AtmelPrint(DEBUG_LEVEL_INFO, DBG_PNP, "Screen Size T100: X: %d Y: %d\n", geo->max_x, geo->max_y);
 
 	return status;
 }
 
+static NTSTATUS mxt_read_touch_geometry(PATMEL_CONTEXT devContext, struct mxt_touch_geometry *geo)
+{
+	RtlZeroMemory(geo, sizeof(*geo));
+
+	if (devContext->multitouch == MXT_TOUCH_MULTI_T9)
+		return mxt_read_t9_resolution(devContext, geo);
+	else if (devContext->multitouch == MXT_TOUCH_MULTITOUCHSCREEN_T100)
+		return mxt_read_t100_config(devContext, geo);
+
+	return STATUS_NOT_SUPPORTED;
+}
+
+/*
+* Switch the decoder over to freshly read geometry. The transform is
+* applied to the new ranges and the lookups are rebuilt from them, so
+* callers other than the boot path hold ContactLock.
+*/
+static VOID mxt_apply_touch_geometry(PATMEL_CONTEXT devContext, struct mxt_touch_geometry *geo)
+{
+	devContext->max_x = geo->max_x;
+	devContext->max_y = geo->max_y;
+	devContext->t100_aux_vect = geo->t100_aux_vect;
+	devContext->t100_aux_ampl = geo->t100_aux_ampl;
+	devContext->t100_aux_area = geo->t100_aux_area;
+
+	AtmelSelectDecoder(devContext);
+}
+
 static NTSTATUS mxt_set_t7_power_cfg(PATMEL_CONTEXT  devContext, uint8_t sleep)
 {
-	struct t7_config *new_config;
-	struct t7_config deepsleep;
-	deepsleep.active = deepsleep.idle = 0;
-	struct t7_config active;
-	active.active = 20;
-	active.idle = 100;
-
-	if (sleep == MXT_POWER_CFG_DEEPSLEEP)
-		new_config = &deepsleep;
+	struct mxt_write_batch batch;
+	struct t7_config new_config;
+	struct mxt_object *obj;
+
+	NTSTATUS status;
+	LONG profile = devContext->PowerProfileTarget;
+
+	if (sleep == MXT_POWER_CFG_DEEPSLEEP) {
+		new_config.active = new_config.idle = 0;
+	}
+	else if (profile == ATMEL_POWER_PROFILE_INTERACTIVE) {
+		new_config.active = new_config.idle = (uint8_t)devContext->InteractiveInterval;
+	}
+	else {
+		new_config = devContext->t7_cfg;
+	}
+
+	obj = mxt_findobject(&devContext->core, MXT_GEN_POWER_T7);
+	if (obj == NULL)
+		return STATUS_NOT_FOUND;
+
+	/* idle and active are adjacent, so a change is a single write */
+	if (devContext->T7_size >= sizeof(new_config) &&
+		RtlEqualMemory(devContext->T7_shadow, &new_config, sizeof(new_config)))
+		status = STATUS_SUCCESS;
 	else {
-		new_config = &active;
+		if (devContext->T7_size)
+			mxt_batch_init(&batch, obj, devContext->T7_shadow, devContext->T7_size);
+		else
+			mxt_batch_init(&batch, obj, NULL, 0);
+		mxt_batch_write_buf(&batch, 0, &new_config, sizeof(new_config));
+		status = mxt_batch_commit(devContext, &batch);
+	}
+
+	if (NT_SUCCESS(status) && sleep != MXT_POWER_CFG_DEEPSLEEP) {
+		devContext->PowerProfile = profile;
+		devContext->AcquisitionInterval = new_config.active;
+	}
+	return status;
+}
+
+static NTSTATUS mxt_set_power(PATMEL_CONTEXT  devContext, uint8_t sleep)
+{
+	struct mxt_write_batch batch;
+	struct mxt_object *obj;
+
+	if (devContext->multitouch == MXT_TOUCH_MULTITOUCHSCREEN_T100)
+		return mxt_set_t7_power_cfg(devContext, sleep);
+
+	obj = mxt_findobject(&devContext->core, MXT_TOUCH_MULTI_T9);
+	if (obj == NULL)
+		return STATUS_NOT_FOUND;
+
+	mxt_batch_init(&batch, obj, NULL, 0);
+	mxt_batch_write(&batch, MXT_T9_CTRL, sleep == MXT_POWER_CFG_DEEPSLEEP ? 0 : 0x83);
+	return mxt_batch_commit(devContext, &batch);
+}
+
+static VOID
+AtmelRevalidateConfig(PATMEL_CONTEXT devContext)
+{
+	/* the controller reloaded or changed its config, refresh what we cache from it */
+	if (devContext->T7_size) {
+		if (!NT_SUCCESS(mxt_read_reg(devContext, devContext->T7_address,
+			devContext->T7_shadow, devContext->T7_size)))
+			devContext->T7_size = 0;
+	}
+
+	struct mxt_touch_geometry geo;
+
+	/*
+	* The bus reads go into locals; decode and the timer use the ranges
+	* and lookups under ContactLock, so they switch over in one go. On
+	* failure the old decoder and the already transformed ranges stay.
+	*/
+	if (NT_SUCCESS(mxt_read_touch_geometry(devContext, &geo))) {
+		WdfSpinLockAcquire(devContext->ContactLock);
+		mxt_apply_touch_geometry(devContext, &geo);
+		WdfSpinLockRelease(devContext->ContactLock);
 	}
 
-	return mxt_write_reg_buf(devContext, devContext->T7_address,
-		new_config, sizeof(devContext->t7_cfg));
+	LARGE_INTEGER now = KeQueryPerformanceCounter(NULL);
+	devContext->recovery_ticks = now.QuadPart - devContext->RecoveryStart.QuadPart;
 }
 
 VOID
@@ -248,7 +498,7 @@ AtmelBootWorkItem(
 	PATMEL_CONTEXT pDevice = GetDeviceContext(Device);
 
 	uint8_t test[8];
-	mxt_read_reg(pDevice, pDevice->T44_address, test, 0x07);
+	mxt_read_msg(pDevice, pDevice->T44_address, test, 0x07);
 
 	WdfObjectDelete(WorkItem);
 }
@@ -355,6 +605,10 @@ NTSTATUS BOOTTOUCHSCREEN(
 					*/
 					devContext->T5_msg_size = mxt_obj_size(obj);
 				}
+				else if (devContext->MessageCrc) {
+					/* keep the CRC byte, each message is verified on decode */
+					devContext->T5_msg_size = mxt_obj_size(obj);
+				}
 				else {
 					/* CRC not enabled, so skip last byte */
 					devContext->T5_msg_size = mxt_obj_size(obj) - 1;
@@ -367,6 +621,7 @@ NTSTATUS BOOTTOUCHSCREEN(
 				break;
 			case MXT_GEN_POWER_T7:
 				devContext->T7_address = obj->start_address;
+				devContext->T7_size = (uint8_t)min(mxt_obj_size(obj), sizeof(devContext->T7_shadow));
 				break;
 			case MXT_TOUCH_MULTI_T9:
 				devContext->multitouch = MXT_TOUCH_MULTI_T9;
@@ -394,12 +649,58 @@ NTSTATUS BOOTTOUCHSCREEN(
 
 		devContext->max_reportid = reportid;
 
+		/*
+		* A drain reads whole T5 messages, CRC byte included in message
+		* CRC mode. A limit below one message would leave CHG asserted
+		* with nothing ever read, so raise it to a single message.
+		*/
+		if (devContext->I2CContext.MaxTransferSize != 0 &&
+			devContext->I2CContext.MaxTransferSize < devContext->T5_msg_size) {
+			AtmelPrint(DEBUG_LEVEL_ERROR, DBG_PNP,
+				"MaxTransferSize %d is below one %d byte message, using %d\n",
+				devContext->I2CContext.MaxTransferSize, devContext->T5_msg_size,
+				devContext->T5_msg_size);
+			devContext->I2CContext.MaxTransferSize = devContext->T5_msg_size;
+		}
+
+		/* one drain buffer per ring frame, plus a scratch one */
+		size_t frame_size = 1 + devContext->max_reportid * devContext->T5_msg_size;
+
+		devContext->MsgBuf = (uint8_t *)ExAllocatePoolWithTag(NonPagedPool,
+			frame_size * (ATMEL_FRAME_RING_SIZE + 1), ATMEL_POOL_TAG);
+		if (devContext->MsgBuf == NULL) {
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+
+		for (int i = 0; i < ATMEL_FRAME_RING_SIZE; i++)
+			devContext->Frames[i].Data = devContext->MsgBuf + frame_size * i;
+		devContext->ScratchFrame.Data = devContext->MsgBuf + frame_size * ATMEL_FRAME_RING_SIZE;
+
+		if (devContext->T7_size) {
+			status = mxt_read_reg(devContext, devContext->T7_address,
+				devContext->T7_shadow, devContext->T7_size);
+			if (!NT_SUCCESS(status))
+				devContext->T7_size = 0;
+		}
+		if (devContext->T7_size >= sizeof(struct t7_config)) {
+			devContext->t7_cfg = *(struct t7_config *)devContext->T7_shadow;
+			devContext->AcquisitionInterval = devContext->t7_cfg.active;
+		}
+
+		/* a controller left in deep sleep has no factory values to restore */
+		if (devContext->t7_cfg.active == 0 && devContext->t7_cfg.idle == 0) {
+			devContext->t7_cfg.active = 20;
+			devContext->t7_cfg.idle = 100;
+		}
+
 		AtmelProcessMessagesUntilInvalid(devContext);
 
-		if (devContext->multitouch == MXT_TOUCH_MULTI_T9)
-			mxt_read_t9_resolution(devContext);
-		else if (devContext->multitouch == MXT_TOUCH_MULTITOUCHSCREEN_T100)
-			mxt_read_t100_config(devContext);
+		struct mxt_touch_geometry geo;
+
+		if (NT_SUCCESS(mxt_read_touch_geometry(devContext, &geo)))
+			mxt_apply_touch_geometry(devContext, &geo);
+		else
+			AtmelSelectDecoder(devContext);
 
 		if (devContext->multitouch == MXT_TOUCH_MULTI_T9 || devContext->multitouch == MXT_TOUCH_MULTITOUCHSCREEN_T100) {
 			uint16_t max_x[] = { devContext->max_x };
@@ -415,6 +716,13 @@ NTSTATUS BOOTTOUCHSCREEN(
 			devContext->max_y_hid[1] = max_y8bit[1];
 		}
 
+		/* only T100 tells a stylus apart from a finger */
+		if (devContext->multitouch != MXT_TOUCH_MULTITOUCHSCREEN_T100)
+			devContext->PenEnabled = false;
+		devContext->PenSlot = ATMEL_PEN_NONE;
+
+		AtmelBuildDescriptors(devContext);
+
 		status = atmel_reset_device(devContext);
 		if (!NT_SUCCESS(status)) {
 			return status;
@@ -437,18 +745,9 @@ NTSTATUS BOOTTOUCHSCREEN(
 		return status;
 	}
 	else {
-		if (devContext->multitouch == MXT_TOUCH_MULTITOUCHSCREEN_T100) {
-			status = mxt_set_t7_power_cfg(devContext, MXT_POWER_CFG_RUN);
-			if (!NT_SUCCESS(status)) {
-				return status;
-			}
-		}
-		else {
-			struct mxt_object *obj = mxt_findobject(&devContext->core, MXT_TOUCH_MULTI_T9);
-			status = mxt_write_object_off(devContext, obj, MXT_T9_CTRL, 0x83);
-			if (!NT_SUCCESS(status)) {
-				return status;
-			}
+		status = mxt_set_power(devContext, MXT_POWER_CFG_RUN);
+		if (!NT_SUCCESS(status)) {
+			return status;
 		}
 
 		status = atmel_reset_device(devContext);
@@ -456,6 +755,105 @@ NTSTATUS BOOTTOUCHSCREEN(
 	}
 }
 
+static ULONG
+AtmelQuerySetting(
+	_In_opt_ WDFKEY Key,
+	_In_ PCWSTR Name,
+	_In_ ULONG Default
+)
+{
+	UNICODE_STRING valueName;
+	ULONG value;
+
+	if (Key == NULL)
+		return Default;
+
+	RtlInitUnicodeString(&valueName, Name);
+
+	if (!NT_SUCCESS(WdfRegistryQueryULong(Key, &valueName, &value)))
+		return Default;
+
+	return value;
+}
+
+static VOID
+AtmelReadSettings(
+	_In_ PATMEL_CONTEXT pDevice
+)
+/*++
+
+Routine Description:
+
+Reads the optional tuning values from the device's Settings key.
+Missing values keep their defaults.
+
+Arguments:
+
+pDevice - the device context to fill in
+
+--*/
+{
+	WDFKEY hKey = NULL;
+	WDFKEY settingsKey = NULL;
+	NTSTATUS status;
+	DECLARE_CONST_UNICODE_STRING(settingsName, L"Settings");
+
+	status = WdfDeviceOpenRegistryKey(pDevice->FxDevice,
+		PLUGPLAY_REGKEY_DEVICE,
+		KEY_READ,
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&hKey);
+
+	if (NT_SUCCESS(status)) {
+		status = WdfRegistryOpenKey(hKey,
+			&settingsName,
+			KEY_READ,
+			WDF_NO_OBJECT_ATTRIBUTES,
+			&settingsKey);
+
+		if (!NT_SUCCESS(status))
+			settingsKey = NULL;
+	}
+
+	pDevice->I2CContext.MaxTransferSize = AtmelQuerySetting(settingsKey, L"MaxTransferSize", 0);
+	pDevice->PollThreshold = AtmelQuerySetting(settingsKey, L"PollThreshold", ATMEL_DEFAULT_POLL_THRESHOLD);
+	pDevice->MessageCrc = AtmelQuerySetting(settingsKey, L"MessageCrc", 0) != 0;
+	pDevice->PressureMin = AtmelQuerySetting(settingsKey, L"PressureMin", 0);
+	pDevice->PressureMax = AtmelQuerySetting(settingsKey, L"PressureMax", 0xff);
+	pDevice->PressureCurve = AtmelQuerySetting(settingsKey, L"PressureCurve", 0);
+	pDevice->LowConfidenceTypes = AtmelQuerySetting(settingsKey, L"LowConfidenceTypes", ATMEL_DEFAULT_LOW_CONFIDENCE_TYPES);
+	pDevice->SuppressedTypes = AtmelQuerySetting(settingsKey, L"SuppressedTypes", ATMEL_DEFAULT_SUPPRESSED_TYPES);
+	pDevice->PenEnabled = AtmelQuerySetting(settingsKey, L"PenCollection", 0) != 0;
+	pDevice->DeltaReports = AtmelQuerySetting(settingsKey, L"DeltaReports", 0) != 0;
+	pDevice->DeltaThreshold = AtmelQuerySetting(settingsKey, L"DeltaThreshold", 0);
+	pDevice->FullFrameInterval = AtmelQuerySetting(settingsKey, L"FullFrameInterval", ATMEL_DEFAULT_FULL_FRAME_INTERVAL);
+	pDevice->Hysteresis = AtmelQuerySetting(settingsKey, L"Hysteresis", ATMEL_DEFAULT_HYSTERESIS);
+	pDevice->Smoothing = AtmelQuerySetting(settingsKey, L"Smoothing", 0) != 0;
+	pDevice->SmoothMinCutoff = AtmelQuerySetting(settingsKey, L"SmoothMinCutoff", ATMEL_DEFAULT_SMOOTH_MIN_CUTOFF);
+	pDevice->SmoothBeta = AtmelQuerySetting(settingsKey, L"SmoothBeta", ATMEL_DEFAULT_SMOOTH_BETA);
+	pDevice->PredictionHorizon = AtmelQuerySetting(settingsKey, L"PredictionHorizon", 0);
+	pDevice->Transform[ATMEL_TRANSFORM_XX] = (LONG)AtmelQuerySetting(settingsKey, L"TransformXX", ATMEL_TRANSFORM_ONE);
+	pDevice->Transform[ATMEL_TRANSFORM_XY] = (LONG)AtmelQuerySetting(settingsKey, L"TransformXY", 0);
+	pDevice->Transform[ATMEL_TRANSFORM_X0] = (LONG)AtmelQuerySetting(settingsKey, L"TransformX0", 0);
+	pDevice->Transform[ATMEL_TRANSFORM_YX] = (LONG)AtmelQuerySetting(settingsKey, L"TransformYX", 0);
+	pDevice->Transform[ATMEL_TRANSFORM_YY] = (LONG)AtmelQuerySetting(settingsKey, L"TransformYY", ATMEL_TRANSFORM_ONE);
+	pDevice->Transform[ATMEL_TRANSFORM_Y0] = (LONG)AtmelQuerySetting(settingsKey, L"TransformY0", 0);
+	pDevice->EdgeRejection = AtmelQuerySetting(settingsKey, L"EdgeRejection", ATMEL_EDGE_OFF);
+	pDevice->EdgeBand = min(AtmelQuerySetting(settingsKey, L"EdgeBand", 10), 500);
+	pDevice->StaleContactTimeout = min(AtmelQuerySetting(settingsKey, L"StaleContactTimeout", ATMEL_DEFAULT_STALE_CONTACT_TIMEOUT), 3600000);
+	pDevice->PowerIdleTimeout = AtmelQuerySetting(settingsKey, L"PowerIdleTimeout", ATMEL_DEFAULT_POWER_IDLE_TIMEOUT);
+	pDevice->InteractiveInterval = AtmelQuerySetting(settingsKey, L"InteractiveInterval", ATMEL_DEFAULT_INTERACTIVE_INTERVAL);
+
+	/* T7 reads 0 as deep sleep and 0xff as free run, neither is an interval */
+	pDevice->InteractiveInterval = max(1, min(pDevice->InteractiveInterval, 0xfe));
+
+	if (settingsKey != NULL)
+		WdfRegistryClose(settingsKey);
+
+	if (hKey != NULL)
+		WdfRegistryClose(hKey);
+}
+
 NTSTATUS
 OnPrepareHardware(
 	_In_  WDFDEVICE     FxDevice,
@@ -543,6 +941,10 @@ Status
 		status = STATUS_NOT_FOUND;
 	}
 
+	AtmelReadSettings(pDevice);
+	AtmelBuildPressureLut(pDevice);
+	AtmelBuildSmoothingLut(pDevice);
+
 	status = SpbTargetInitialize(FxDevice, &pDevice->I2CContext);
 
 	if (!NT_SUCCESS(status))
@@ -592,6 +994,12 @@ Status
 
 	pDevice->core.buf = NULL;
 
+	if (pDevice->MsgBuf != NULL) {
+		ExFreePoolWithTag(pDevice->MsgBuf, ATMEL_POOL_TAG);
+	}
+
+	pDevice->MsgBuf = NULL;
+
 	pDevice->msgprocobj = NULL;
 	pDevice->cmdprocobj = NULL;
 
@@ -629,13 +1037,38 @@ Status
 
 	WdfTimerStart(pDevice->Timer, WDF_REL_TIMEOUT_IN_MS(10));
 
+	mxt_wake(pDevice);
+
 	atmel_reset_device(pDevice);
 
-	for (int i = 0; i < 20; i++) {
+	for (int i = 0; i < ATMEL_MAX_CONTACTS; i++) {
 		pDevice->Flags[i] = 0;
 	}
+	pDevice->PenSlot = ATMEL_PEN_NONE;
+	pDevice->PenDirty = false;
+	RtlZeroMemory(&pDevice->TouchSnapshot, sizeof(pDevice->TouchSnapshot));
+	RtlZeroMemory(&pDevice->PenSnapshot, sizeof(pDevice->PenSnapshot));
+	RtlZeroMemory(pDevice->ReportedStatus, sizeof(pDevice->ReportedStatus));
+	pDevice->FramesSinceFull = 0;
+	pDevice->ReportDirty = false;
+	RtlZeroMemory(pDevice->EdgeContact, sizeof(pDevice->EdgeContact));
+	pDevice->ActiveMask = 0;
+	pDevice->ProbeMask = 0;
+
+	/* the reset above brought back the factory T7 values */
+	pDevice->PowerProfile = ATMEL_POWER_PROFILE_FACTORY;
+	pDevice->PowerProfileTarget = ATMEL_POWER_PROFILE_FACTORY;
+	pDevice->LastActivity = 0;
 
 	pDevice->RegsSet = false;
+
+	/* the framework reenables the interrupt after D0Entry */
+	pDevice->PollMode = false;
+	pDevice->InterruptMasked = false;
+	pDevice->StormPending = 0;
+	pDevice->interrupt_count = 0;
+	pDevice->rate_window_start = KeQueryInterruptTime();
+
 	pDevice->ConnectInterrupt = true;
 
 	AtmelCompleteIdleIrp(pDevice);
@@ -644,20 +1077,23 @@ Status
 }
 
 NTSTATUS
-OnD0Exit(
+OnD0ExitPreInterruptsDisabled(
 	_In_  WDFDEVICE               FxDevice,
-	_In_  WDF_POWER_DEVICE_STATE  FxPreviousState
+	_In_  WDF_POWER_DEVICE_STATE  FxTargetState
 )
 /*++
 
 Routine Description:
 
-This routine destroys objects needed by the driver.
+Hands the interrupt back to the framework unmasked before it disables
+it. The storm governor masks the interrupt with WdfInterruptDisable
+while polling; leaving it masked across D0 exit would unbalance the
+framework's disable here and its enable at the next D0Entry.
 
 Arguments:
 
 FxDevice - a handle to the framework device object
-FxPreviousState - previous power state
+FxTargetState - power state being entered
 
 Return Value:
 
@@ -665,149 +1101,114 @@ Status
 
 --*/
 {
-	UNREFERENCED_PARAMETER(FxPreviousState);
+	UNREFERENCED_PARAMETER(FxTargetState);
 
 	PATMEL_CONTEXT pDevice = GetDeviceContext(FxDevice);
 
-	if (pDevice->multitouch == MXT_TOUCH_MULTITOUCHSCREEN_T100)
-		mxt_set_t7_power_cfg(pDevice, MXT_POWER_CFG_DEEPSLEEP);
-	else {
-		struct mxt_object *obj = mxt_findobject(&pDevice->core, MXT_TOUCH_MULTI_T9);
-		mxt_write_object_off(pDevice, obj, MXT_T9_CTRL, 0);
-	}
+	/* no new storm may mask the interrupt until D0Entry */
+	InterlockedExchange(&pDevice->StormPending, ATMEL_STORM_BLOCKED);
 
 	WdfTimerStop(pDevice->Timer, TRUE);
+	WdfWorkItemFlush(pDevice->PollWorkItem);
 
-	pDevice->ConnectInterrupt = false;
+	if (pDevice->InterruptMasked) {
+		pDevice->PollMode = false;
+		WdfInterruptEnable(pDevice->Interrupt);
+		pDevice->InterruptMasked = false;
+	}
 
 	return STATUS_SUCCESS;
 }
 
-int AtmelProcessMessage(PATMEL_CONTEXT pDevice, uint8_t *message) {
-	uint8_t report_id = message[0];
+NTSTATUS
+OnD0Exit(
+	_In_  WDFDEVICE               FxDevice,
+	_In_  WDF_POWER_DEVICE_STATE  FxPreviousState
+)
+/*++
 
-	if (report_id == 0xff)
-		return 0;
+Routine Description:
 
-	if (report_id == pDevice->T6_reportid) {
-		uint8_t status = message[1];
-		uint32_t crc = message[2] | (message[3] << 8) | (message[4] << 16);
-	}
-	else if (report_id >= pDevice->T9_reportid_min && report_id <= pDevice->T9_reportid_max) {
-		uint8_t flags = message[1];
+This routine destroys objects needed by the driver.
 
-		int rawx = (message[2] << 4) | ((message[4] >> 4) & 0xf);
-		int rawy = (message[3] << 4) | ((message[4] & 0xf));
+Arguments:
 
-		/* Handle 10/12 bit switching */
-		if (pDevice->max_x < 1024)
-			rawx >>= 2;
-		if (pDevice->max_y < 1024)
-			rawy >>= 2;
+FxDevice - a handle to the framework device object
+FxPreviousState - previous power state
 
-		uint8_t area = message[5];
-		uint8_t ampl = message[6];
+Return Value:
 
-		pDevice->Flags[report_id] = flags;
-		pDevice->XValue[report_id] = rawx;
-		pDevice->YValue[report_id] = rawy;
-		pDevice->AREA[report_id] = area;
-	}
-	else if (report_id >= pDevice->T100_reportid_min && report_id <= pDevice->T100_reportid_max) {
-		int reportid = report_id - pDevice->T100_reportid_min - 2;
+Status
 
-		uint8_t flags = message[1];
+--*/
+{
+	UNREFERENCED_PARAMETER(FxPreviousState);
 
-		uint8_t t9_flags = 0; //convert T100 flags to T9
-		if (flags & MXT_T100_DETECT)
-			t9_flags += MXT_T9_DETECT;
-		else if (pDevice->Flags[reportid] & MXT_T100_DETECT)
-			t9_flags += MXT_T9_RELEASE;
+	PATMEL_CONTEXT pDevice = GetDeviceContext(FxDevice);
 
-		int rawx = *((uint16_t *)&message[2]);
-		int rawy = *((uint16_t *)&message[4]);
+	WdfTimerStop(pDevice->Timer, TRUE);
 
-		if (reportid >= 0) {
-			pDevice->Flags[reportid] = t9_flags;
+	pDevice->ConnectInterrupt = false;
 
-			pDevice->XValue[reportid] = rawx;
-			pDevice->YValue[reportid] = rawy;
-			pDevice->AREA[reportid] = 10;
-		}
-	}
+	WdfWorkItemFlush(pDevice->PollWorkItem);
+	WdfWorkItemFlush(pDevice->ProcessWorkItem);
 
-	struct _ATMEL_MULTITOUCH_REPORT report;
-	report.ReportID = REPORTID_MTOUCH;
+	/*
+	* Nothing can queue bus work any more. Drop follow-ups such as a
+	* power profile switch or REPORTALL so they cannot reach the
+	* controller after it has been put to sleep.
+	*/
+	InterlockedExchange(&pDevice->PendingActions, 0);
 
-	int count = 0, i = 0;
-	while (count < 10 && i < 20) {
-		if (pDevice->Flags[i] != 0) {
-			report.Touch[count].ContactID = i;
-			report.Touch[count].Height = pDevice->AREA[i];
-			report.Touch[count].Width = pDevice->AREA[i];
+	mxt_set_power(pDevice, MXT_POWER_CFG_DEEPSLEEP);
 
-			report.Touch[count].XValue = pDevice->XValue[i];
-			report.Touch[count].YValue = pDevice->YValue[i];
+	return STATUS_SUCCESS;
+}
 
-			uint8_t flags = pDevice->Flags[i];
-			if (flags & MXT_T9_DETECT) {
-				report.Touch[count].Status = MULTI_CONFIDENCE_BIT | MULTI_TIPSWITCH_BIT;
-			}
-			else if (flags & MXT_T9_PRESS) {
-				report.Touch[count].Status = MULTI_CONFIDENCE_BIT | MULTI_TIPSWITCH_BIT;
-			}
-			else if (flags & MXT_T9_RELEASE) {
-				report.Touch[count].Status = MULTI_CONFIDENCE_BIT;
-				pDevice->Flags[i] = 0;
-			}
-			else
-				report.Touch[count].Status = 0;
+static int AtmelReadMessages(PATMEL_CONTEXT pDevice, uint8_t *msg_buf, uint8_t count) {
+	/*
+	* T5 pops one message per T5_msg_size bytes read, so a drain larger
+	* than the controller's transfer limit is split into reads of whole
+	* messages, each starting again at T5.
+	*/
+	uint8_t per_xfer = count;
+	if (pDevice->I2CContext.MaxTransferSize != 0) {
+		/* boot raises the limit to at least one message */
+		ULONG fit = pDevice->I2CContext.MaxTransferSize / pDevice->T5_msg_size;
+		if (fit < per_xfer)
+			per_xfer = (uint8_t)fit;
+	}
+
+	uint8_t read = 0;
+	while (read < count) {
+		uint8_t n = (uint8_t)min(count - read, per_xfer);
+
+		NTSTATUS status = mxt_read_msg(pDevice, pDevice->T5_address,
+			msg_buf + pDevice->T5_msg_size * read, pDevice->T5_msg_size * n);
+		if (!NT_SUCCESS(status))
+			break;
 
-			count++;
-		}
-		i++;
+		read += n;
 	}
 
-	report.ActualCount = count;
-
-	if (count > 0) {
-		size_t bytesWritten;
-		AtmelProcessVendorReport(pDevice, &report, sizeof(report), &bytesWritten);
-	}
-	pDevice->RegsSet = true;
-	return 1;
+	/* return number of messages read */
+	return read;
 }
 
-int AtmelReadAndProcessMessages(PATMEL_CONTEXT pDevice, uint8_t count) {
-	uint8_t num_valid = 0;
-	int i, ret;
-	if (count > pDevice->max_reportid)
-		return -1;
-
-	uint8_t *msg_buf = (uint8_t *)ExAllocatePoolWithTag(NonPagedPool, pDevice->max_reportid * pDevice->T5_msg_size, ATMEL_POOL_TAG);
+static int AtmelCaptureMessages(PATMEL_CONTEXT pDevice, ATMEL_FRAME *frame, uint8_t count) {
+	uint8_t *msg_buf = frame->Data + 1 + pDevice->T5_msg_size * frame->Count;
+	int read;
 
-	for (int i = 0; i < pDevice->max_reportid * pDevice->T5_msg_size; i++) {
-		msg_buf[i] = 0xff;
-	}
-
-	NTSTATUS status = mxt_read_reg(pDevice, pDevice->T5_address, msg_buf, pDevice->T5_msg_size * count);
-	if (!NT_SUCCESS(status)) {
-		ExFreePoolWithTag(msg_buf, ATMEL_POOL_TAG);
+	/* never read past the frame buffer */
+	count = (uint8_t)min(count, pDevice->max_reportid - frame->Count);
+	if (count == 0)
 		return 0;
-	}
-
-	for (i = 0; i < count; i++) {
-		ret = AtmelProcessMessage(pDevice,
-			msg_buf + pDevice->T5_msg_size * i);
-
-		if (ret == 1)
-			num_valid++;
-	}
 
-	ExFreePoolWithTag(msg_buf, ATMEL_POOL_TAG);
+	read = AtmelReadMessages(pDevice, msg_buf, count);
+	frame->Count += (uint8_t)read;
 
-	/* return number of messages read */
-	return num_valid;
+	/* return number of valid messages */
+	return AtmelCountMessages(pDevice, msg_buf, read);
 }
 
 int AtmelProcessMessagesUntilInvalid(PATMEL_CONTEXT pDevice) {
@@ -816,114 +1217,198 @@ int AtmelProcessMessagesUntilInvalid(PATMEL_CONTEXT pDevice) {
 
 	count = pDevice->max_reportid;
 	do {
-		read = AtmelReadAndProcessMessages(pDevice, count);
+		pDevice->ScratchFrame.Count = 0;
+		read = AtmelCaptureMessages(pDevice, &pDevice->ScratchFrame, count);
 		if (read < count)
 			return 0;
 	} while (--tries);
 	return -1;
 }
 
-bool AtmelDeviceReadT44(PATMEL_CONTEXT pDevice) {
+int AtmelDeviceReadT44(PATMEL_CONTEXT pDevice, ATMEL_FRAME *frame) {
 	NTSTATUS status;
-	int ret;
-	uint8_t count, num_left;
-
-	uint8_t *msg_buf = (uint8_t *)ExAllocatePoolWithTag(NonPagedPool, pDevice->T5_msg_size + 1, ATMEL_POOL_TAG);
-
-	/* Read T44 and T5 together */
-	status = mxt_read_reg(pDevice, pDevice->T44_address, msg_buf, pDevice->T5_msg_size);
+	uint8_t count;
+
+	/*
+	* Read T44 and T5 together, except in message CRC mode, where the CRC
+	* read flag only applies to T5, and when the pair would exceed the
+	* controller's transfer limit. There T44 is read alone and every
+	* message comes from the chunked T5 drain.
+	*/
+	bool combined = !pDevice->MessageCrc &&
+		(pDevice->I2CContext.MaxTransferSize == 0 ||
+		(ULONG)pDevice->T5_msg_size + 1 <= pDevice->I2CContext.MaxTransferSize);
+
+	status = mxt_read_msg(pDevice, pDevice->T44_address, frame->Data,
+		combined ? pDevice->T5_msg_size + 1 : 1);
 	if (!NT_SUCCESS(status)) {
-		goto end;
+		return 0;
 	}
 
-	count = msg_buf[0];
+	count = frame->Data[0];
 
 	if (count == 0)
-		goto end;
+		return 0;
 
 	if (count > pDevice->max_reportid) {
 		count = pDevice->max_reportid;
 	}
 
-	ret = AtmelProcessMessage(pDevice, msg_buf + 1);
-	if (ret < 0) {
-		goto end;
-	}
+	/* read the rest straight after the first message so the whole drain decodes in one pass */
+	frame->Count = combined ? 1 : 0;
+	if (count > frame->Count)
+		AtmelCaptureMessages(pDevice, frame, count - frame->Count);
+
+	/* return number of valid messages */
+	return AtmelCountMessages(pDevice, frame->Data + 1, frame->Count);
+}
 
-	num_left = count - 1;
+static uint8_t AtmelPredictDrain(PATMEL_CONTEXT pDevice) {
+	uint8_t predicted = 0;
 
-	if (num_left) {
-		ret = AtmelReadAndProcessMessages(pDevice, num_left);
-		if (ret < 0)
-			goto end;
-		//else if (ret != num_left)
-		///	DbgPrint("T44: Unexpected invalid message!\n");
-	}
+	for (int i = 0; i < ATMEL_DRAIN_WINDOW; i++)
+		predicted = max(predicted, pDevice->drain_history[i]);
 
-end:
-	ExFreePoolWithTag(msg_buf, ATMEL_POOL_TAG);
-	return true;
+	return predicted;
+}
+
+static void AtmelRecordDrain(PATMEL_CONTEXT pDevice, uint8_t predicted, int actual) {
+	int error = actual - predicted;
+
+	error = max(-ATMEL_DRAIN_ERROR_SPAN, min(error, ATMEL_DRAIN_ERROR_SPAN));
+	pDevice->drain_error_hist[error + ATMEL_DRAIN_ERROR_SPAN]++;
+
+	pDevice->drain_history[pDevice->drain_history_pos] = (uint8_t)min(actual, 0xff);
+	pDevice->drain_history_pos = (pDevice->drain_history_pos + 1) % ATMEL_DRAIN_WINDOW;
 }
 
-bool AtmelDeviceRead(PATMEL_CONTEXT pDevice) {
+int AtmelDeviceRead(PATMEL_CONTEXT pDevice, ATMEL_FRAME *frame) {
 	int total_handled, num_handled;
-	uint8_t count = pDevice->last_message_count;
+	uint8_t predicted;
+	uint8_t count;
+
+	/* the controller reset or overflowed, history no longer applies */
+	if (InterlockedExchange(&pDevice->DrainReset, 0))
+		RtlZeroMemory(pDevice->drain_history, sizeof(pDevice->drain_history));
 
-	if (count < 1 || count > pDevice->max_reportid)
+	predicted = AtmelPredictDrain(pDevice);
+	count = predicted;
+	uint8_t chunk = 2;
+
+	if (count >= pDevice->max_reportid)
+		count = pDevice->max_reportid - 1;
+	if (count < 1)
 		count = 1;
 
 	/* include final invalid message */
-	total_handled = AtmelReadAndProcessMessages(pDevice, count + 1);
-	if (total_handled < 0)
-		return false;
-	else if (total_handled <= count)
+	total_handled = AtmelCaptureMessages(pDevice, frame, count + 1);
+	if (total_handled <= count)
 		goto update_count;
 
-	/* keep reading two msgs until one is invalid or reportid limit */
+	/* underpredicted: keep reading, doubling each read, until one is invalid or reportid limit */
 	do {
-		num_handled = AtmelReadAndProcessMessages(pDevice, 2);
-		if (num_handled < 0)
-			return false;
+		num_handled = AtmelCaptureMessages(pDevice, frame, chunk);
 
 		total_handled += num_handled;
 
-		if (num_handled < 2)
+		if (num_handled < chunk)
 			break;
+
+		chunk = (uint8_t)min(chunk * 2, pDevice->max_reportid);
 	} while (total_handled < pDevice->num_touchids);
 
 update_count:
-	pDevice->last_message_count = total_handled;
+	AtmelRecordDrain(pDevice, predicted, total_handled);
 
-	return true;
+	return total_handled;
+}
+
+static bool AtmelContactChanged(PATMEL_CONTEXT pDevice, int i, BYTE status) {
+	int dx = pDevice->XValue[i] - pDevice->ReportedX[i];
+	int dy = pDevice->YValue[i] - pDevice->ReportedY[i];
+	int threshold = (int)min(pDevice->DeltaThreshold, 0xffff);
+
+	if (status != pDevice->ReportedStatus[i])
+		return true;
+
+	return dx > threshold || -dx > threshold || dy > threshold || -dy > threshold;
 }
 
-void AtmelProcessInput(PATMEL_CONTEXT pDevice) {
+/*
+* Returns TRUE when a touch report was delivered to a pending read.
+*/
+BOOLEAN AtmelProcessInput(PATMEL_CONTEXT pDevice) {
 	struct _ATMEL_MULTITOUCH_REPORT report;
 	report.ReportID = REPORTID_MTOUCH;
 
-	int count = 0, i = 0;
-	while (count < 10 && i < 20) {
-		if (pDevice->Flags[i] != 0) {
-			report.Touch[count].ContactID = i;
-			report.Touch[count].Height = pDevice->AREA[i];
-			report.Touch[count].Width = pDevice->AREA[i];
+	/* nothing moved or changed state since the last delivered report */
+	if (!pDevice->ReportDirty) {
+		pDevice->reports_skipped++;
+		return FALSE;
+	}
 
-			report.Touch[count].XValue = pDevice->XValue[i];
-			report.Touch[count].YValue = pDevice->YValue[i];
+	/*
+	* Every live contact is in every report, as Windows treats a contact
+	* left out as lifted. Delta mode only decides whether the report is
+	* worth sending: some contact changed tip state or moved past
+	* DeltaThreshold, or FullFrameInterval frames were held back. It
+	* lowers the report rate, never the size of a report.
+	*/
+	bool send = !pDevice->DeltaReports ||
+		pDevice->FramesSinceFull + 1 >= pDevice->FullFrameInterval;
 
+	int count = 0, i = 0;
+	while (count < 10 && i < ATMEL_MAX_CONTACTS) {
+		if (pDevice->Flags[i] != 0) {
 			uint8_t flags = pDevice->Flags[i];
-			if (flags & MXT_T9_DETECT) {
-				report.Touch[count].Status = MULTI_CONFIDENCE_BIT | MULTI_TIPSWITCH_BIT;
+			BYTE confidence = pDevice->Confident[i] ? MULTI_CONFIDENCE_BIT : 0;
+			BYTE status;
+
+			/*
+			* A slot retouched before its lift was delivered sends the
+			* lift first, as the host last saw that contact.
+			*/
+			bool relift = (flags & MXT_T9_RELEASE) &&
+				(flags & (MXT_T9_DETECT | MXT_T9_PRESS));
+
+			if (relift) {
+				status = pDevice->ReportedStatus[i] & MULTI_CONFIDENCE_BIT;
+			}
+			else if (flags & MXT_T9_DETECT) {
+				status = confidence | MULTI_TIPSWITCH_BIT;
 			}
 			else if (flags & MXT_T9_PRESS) {
-				report.Touch[count].Status = MULTI_CONFIDENCE_BIT | MULTI_TIPSWITCH_BIT;
+				status = confidence | MULTI_TIPSWITCH_BIT;
 			}
 			else if (flags & MXT_T9_RELEASE) {
-				report.Touch[count].Status = MULTI_CONFIDENCE_BIT;
-				pDevice->Flags[i] = 0;
+				status = confidence;
 			}
 			else
-				report.Touch[count].Status = 0;
+				status = 0;
+
+			if (!send && AtmelContactChanged(pDevice, i, status))
+				send = true;
+
+			report.Touch[count].Status = status;
+			report.Touch[count].ContactID = i;
+			report.Touch[count].Height = pDevice->HEIGHT[i];
+			report.Touch[count].Width = pDevice->WIDTH[i];
+			report.Touch[count].Azimuth = pDevice->AZIMUTH[i];
+			report.Touch[count].Pressure = pDevice->PRESSURE[i];
+
+			/* down contacts go out at their predicted position */
+			if (status & MULTI_TIPSWITCH_BIT) {
+				report.Touch[count].XValue = pDevice->PredictX[i];
+				report.Touch[count].YValue = pDevice->PredictY[i];
+			}
+			else if (relift) {
+				report.Touch[count].XValue = pDevice->ReportedX[i];
+				report.Touch[count].YValue = pDevice->ReportedY[i];
+			}
+			else {
+				report.Touch[count].XValue = pDevice->XValue[i];
+				report.Touch[count].YValue = pDevice->YValue[i];
+			}
 
 			count++;
 		}
@@ -932,11 +1417,240 @@ void AtmelProcessInput(PATMEL_CONTEXT pDevice) {
 
 	report.ActualCount = count;
 
-	if (count > 0) {
-		size_t bytesWritten;
-		AtmelProcessVendorReport(pDevice, &report, sizeof(report), &bytesWritten);
+	if (count == 0) {
+		pDevice->ReportDirty = false;
+		return FALSE;
+	}
+
+	/*
+	* Only sub-threshold motion: hold it back until it adds up. It stays
+	* dirty, so a contact that comes to rest still has its final position
+	* sent by the timer within FullFrameInterval calls.
+	*/
+	if (!send) {
+		pDevice->FramesSinceFull++;
+		return FALSE;
+	}
+
+	size_t bytesWritten;
+
+	/*
+	* With no read pending the report is not delivered. Leave the
+	* contact state alone so the timer retry sends the same changes and
+	* lifts, and keep ReportDirty set until a read takes it.
+	*/
+	if (!NT_SUCCESS(AtmelProcessVendorReport(pDevice, &report, sizeof(report), &bytesWritten)))
+		return FALSE;
+
+	bool again = false;
+
+	for (i = 0; i < count; i++) {
+		BYTE slot = report.Touch[i].ContactID;
+		BYTE status = report.Touch[i].Status;
+
+		/*
+		* A released slot starts over for whichever contact takes it
+		* next; one retouched behind the lift is reported next time.
+		*/
+		if (!(status & MULTI_TIPSWITCH_BIT) && (pDevice->Flags[slot] & MXT_T9_RELEASE)) {
+			if (pDevice->Flags[slot] & (MXT_T9_DETECT | MXT_T9_PRESS)) {
+				pDevice->Flags[slot] &= ~MXT_T9_RELEASE;
+				again = true;
+			}
+			else {
+				pDevice->Flags[slot] = 0;
+			}
+			status = 0;
+		}
+
+		pDevice->ReportedStatus[slot] = status;
+		pDevice->ReportedX[slot] = pDevice->XValue[slot];
+		pDevice->ReportedY[slot] = pDevice->YValue[slot];
+	}
+
+	pDevice->ReportDirty = again;
+	pDevice->FramesSinceFull = 0;
+	return TRUE;
+}
+/*
+* Returns TRUE once no pen state is waiting for a read.
+*/
+BOOLEAN AtmelProcessPen(PATMEL_CONTEXT pDevice) {
+	size_t bytesWritten;
+
+	if (!pDevice->PenDirty)
+		return TRUE;
+
+	if (!NT_SUCCESS(AtmelProcessVendorReport(pDevice, &pDevice->PenReport,
+		sizeof(pDevice->PenReport), &bytesWritten)))
+		return FALSE;
+
+	pDevice->PenDirty = false;
+	return TRUE;
+}
+
+/*
+* Lift the tracked pen where it was last seen. The lift is sent by the
+* caller or the timer.
+*/
+void AtmelReleasePen(PATMEL_CONTEXT pDevice) {
+	pDevice->PenReport.ReportID = REPORTID_PEN;
+	pDevice->PenReport.Status = 0;
+	pDevice->PenReport.Pressure = 0;
+	pDevice->PenDirty = true;
+	pDevice->PenSlot = ATMEL_PEN_NONE;
+}
+
+static int AtmelCaptureFrame(PATMEL_CONTEXT pDevice) {
+	LONG head = pDevice->FrameHead;
+	bool full = (ULONG)head - (ULONG)pDevice->FrameTail >= ATMEL_FRAME_RING_SIZE;
+	ATMEL_FRAME *frame;
+	LARGE_INTEGER start, end;
+	int handled;
+
+	start = KeQueryPerformanceCounter(NULL);
+
+	/*
+	* If processing has fallen a whole ring behind, the controller is
+	* still drained so CHG deasserts, but into the scratch frame.
+	*/
+	frame = full ? &pDevice->ScratchFrame : &pDevice->Frames[(ULONG)head % ATMEL_FRAME_RING_SIZE];
+	frame->Timestamp = start;
+	frame->Count = 0;
+
+	if (pDevice->T44_address)
+		handled = AtmelDeviceReadT44(pDevice, frame);
+	else
+		handled = AtmelDeviceRead(pDevice, frame);
+
+	/* feeds the power profile governor */
+	if (handled > 0)
+		pDevice->LastActivity = KeQueryInterruptTime();
+
+	if (frame->Count == 0)
+		return handled;
+
+	if (full) {
+		pDevice->frames_dropped++;
+		return handled;
+	}
+
+	end = KeQueryPerformanceCounter(NULL);
+	pDevice->capture_ticks += end.QuadPart - start.QuadPart;
+
+	/* publish the frame, then kick the processing stage */
+	InterlockedIncrement(&pDevice->FrameHead);
+	WdfWorkItemEnqueue(pDevice->ProcessWorkItem);
+
+	return handled;
+}
+
+static void AtmelProcessFrames(PATMEL_CONTEXT pDevice) {
+	LONG tail = pDevice->FrameTail;
+
+	while (tail != pDevice->FrameHead) {
+		ATMEL_FRAME *frame = &pDevice->Frames[(ULONG)tail % ATMEL_FRAME_RING_SIZE];
+		LARGE_INTEGER start, end;
+
+		/* see the frame contents the producer wrote before publishing */
+		KeMemoryBarrier();
+
+		start = KeQueryPerformanceCounter(NULL);
+
+		WdfSpinLockAcquire(pDevice->ContactLock);
+		AtmelProcessMessages(pDevice, frame->Data + 1, frame->Count);
+		AtmelProcessInput(pDevice);
+		WdfSpinLockRelease(pDevice->ContactLock);
+
+		end = KeQueryPerformanceCounter(NULL);
+		pDevice->queue_ticks += start.QuadPart - frame->Timestamp.QuadPart;
+		pDevice->process_ticks += end.QuadPart - start.QuadPart;
+		pDevice->frames_processed++;
+
+		/* hand the slot back to the capture stage */
+		InterlockedExchange(&pDevice->FrameTail, ++tail);
+	}
+
+	/* follow-ups the decoder flagged that need the bus */
+	LONG actions = InterlockedExchange(&pDevice->PendingActions, 0);
+
+	if (actions & ATMEL_ACTION_REVALIDATE_CONFIG)
+		AtmelRevalidateConfig(pDevice);
+
+	if (actions & ATMEL_ACTION_POWER_PROFILE) {
+		if (NT_SUCCESS(mxt_set_t7_power_cfg(pDevice, MXT_POWER_CFG_RUN)))
+			pDevice->power_profile_switches++;
+		else
+			AtmelPrint(DEBUG_LEVEL_ERROR, DBG_PNP, "Failed to switch to T7 power profile %d\n", pDevice->PowerProfileTarget);
 	}
+
+	/* have the controller resend the state of every contact */
+	if ((actions & ATMEL_ACTION_REPORT_ALL) && pDevice->cmdprocobj != NULL)
+		mxt_write_object_off(pDevice, pDevice->cmdprocobj, MXT_CMDPROC_REPORTALL_OFF, 1);
+}
+
+VOID
+AtmelProcessWorkItem(
+	IN WDFWORKITEM  WorkItem
+)
+/*++
+
+Routine Description:
+
+Second stage of interrupt handling. Decodes and reports every frame the
+capture stage has published, oldest first.
+
+WdfWorkItemEnqueue can start the callback again while an earlier run is
+still going, but the frame ring has a single consumer. Only the run that
+owns ProcessRunning drains; after letting go it looks again, so frames
+or actions published while another run bailed out are not stranded.
+
+--*/
+{
+	WDFDEVICE Device = (WDFDEVICE)WdfWorkItemGetParentObject(WorkItem);
+	PATMEL_CONTEXT pDevice = GetDeviceContext(Device);
+
+	do {
+		if (InterlockedCompareExchange(&pDevice->ProcessRunning, 1, 0) != 0)
+			return;
+
+		AtmelProcessFrames(pDevice);
+
+		InterlockedExchange(&pDevice->ProcessRunning, 0);
+	} while (pDevice->FrameTail != pDevice->FrameHead || pDevice->PendingActions != 0);
 }
+
+static void AtmelUpdateInterruptRate(PATMEL_CONTEXT pDevice) {
+	ULONGLONG now = KeQueryInterruptTime();
+	ULONGLONG elapsed = now - pDevice->rate_window_start;
+
+	pDevice->interrupt_count++;
+
+	if (elapsed < ATMEL_RATE_WINDOW)
+		return;
+
+	/* interrupt time is in 100ns units */
+	pDevice->interrupt_rate = (ULONG)(pDevice->interrupt_count * 10000000ULL / elapsed);
+	pDevice->interrupt_count = 0;
+	pDevice->rate_window_start = now;
+
+	if (pDevice->PollThreshold == 0 || pDevice->interrupt_rate < pDevice->PollThreshold)
+		return;
+
+	/*
+	* Storm: hand draining over to the timer. The interrupt can only be
+	* masked at passive level outside the ISR, so the poll work item
+	* masks it and only then enters poll mode. Until it does, the ISR
+	* stays the only producer for the frame ring.
+	*/
+	if (!pDevice->PollMode &&
+		InterlockedCompareExchange(&pDevice->StormPending, ATMEL_STORM_SEEN, 0) == 0) {
+		pDevice->poll_entries++;
+		AtmelPrint(DEBUG_LEVEL_INFO, DBG_IOCTL, "Interrupt storm (%d/s), switching to polling\n", pDevice->interrupt_rate);
+		WdfWorkItemEnqueue(pDevice->PollWorkItem);
+	}
+}
+
 BOOLEAN OnInterruptIsr(
 	WDFINTERRUPT Interrupt,
 	ULONG MessageID) {
@@ -948,16 +1662,149 @@ BOOLEAN OnInterruptIsr(
 	if (!pDevice->ConnectInterrupt)
 		return false;
 
-	bool ret = true;
+	AtmelUpdateInterruptRate(pDevice);
 
-	if (pDevice->T44_address)
-		ret = AtmelDeviceReadT44(pDevice);
-	else
-		ret = AtmelDeviceRead(pDevice);
+	AtmelCaptureFrame(pDevice);
 
-	AtmelProcessInput(pDevice);
+	return true;
+}
+
+VOID
+AtmelPollWorkItem(
+	IN WDFWORKITEM  WorkItem
+)
+/*++
 
-	return ret;
+Routine Description:
+
+Drains the controller while the storm governor has interrupts masked.
+Queued by the ISR when a storm starts, then from the periodic timer, so it
+polls at the timer period. Once no messages arrive for
+ATMEL_POLL_IDLE_EXIT polls in a row the interrupt is unmasked again.
+
+--*/
+{
+	WDFDEVICE Device = (WDFDEVICE)WdfWorkItemGetParentObject(WorkItem);
+	PATMEL_CONTEXT pDevice = GetDeviceContext(Device);
+
+	if (!pDevice->ConnectInterrupt)
+		return;
+
+	/* a run still going when the timer requeues the item keeps the poll */
+	if (InterlockedCompareExchange(&pDevice->PollRunning, 1, 0) != 0)
+		return;
+
+	if (!pDevice->PollMode) {
+		if (pDevice->StormPending != ATMEL_STORM_SEEN)
+			goto exit;
+
+		/*
+		* WdfInterruptDisable waits out a running ISR, so from here on
+		* this work item is the frame ring's only producer.
+		*/
+		WdfInterruptDisable(pDevice->Interrupt);
+		pDevice->InterruptMasked = true;
+		pDevice->poll_idle_count = 0;
+		pDevice->PollMode = true;
+		InterlockedCompareExchange(&pDevice->StormPending, 0, ATMEL_STORM_SEEN);
+	}
+
+	if (AtmelCaptureFrame(pDevice) > 0) {
+		pDevice->poll_idle_count = 0;
+		goto exit;
+	}
+
+	if (++pDevice->poll_idle_count < ATMEL_POLL_IDLE_EXIT)
+		goto exit;
+
+	/* stop producing before the ISR may start again */
+	pDevice->PollMode = false;
+	pDevice->poll_exits++;
+	pDevice->rate_window_start = KeQueryInterruptTime();
+	pDevice->interrupt_count = 0;
+
+	WdfInterruptEnable(pDevice->Interrupt);
+	pDevice->InterruptMasked = false;
+
+exit:
+	InterlockedExchange(&pDevice->PollRunning, 0);
+}
+
+/*
+* Catch contacts whose release was lost. Resting contacts may legitimately
+* go quiet, so a silent contact is first probed with REPORTALL and only
+* released if the controller still says nothing about it. Called from the
+* timer with ContactLock held, walks only the contacts that are down.
+*/
+static void AtmelCheckStaleContacts(PATMEL_CONTEXT pDevice) {
+	/* whole ticks, rounded up so a short timeout still waits one */
+	ULONG base = max(1, (pDevice->StaleContactTimeout + ATMEL_TIMER_PERIOD_MS - 1) / ATMEL_TIMER_PERIOD_MS);
+	ULONG mask = pDevice->ActiveMask;
+	bool probe = false;
+
+	while (mask) {
+		ULONG slot;
+
+		_BitScanForward(&slot, mask);
+		mask &= mask - 1;
+
+		ULONG timeout = base << pDevice->ProbeBackoff[slot];
+		ULONG silent = pDevice->WatchdogTick - pDevice->LastUpdate[slot];
+		if (silent < timeout)
+			continue;
+
+		if (!(pDevice->ProbeMask & BIT(slot))) {
+			pDevice->ProbeMask |= BIT(slot);
+			pDevice->stale_probes++;
+			probe = true;
+		}
+		else if (silent >= timeout + ATMEL_STALE_PROBE_TICKS && slot == pDevice->PenSlot) {
+			AtmelReleasePen(pDevice);
+			pDevice->ActiveMask &= ~BIT(slot);
+			pDevice->ProbeMask &= ~BIT(slot);
+			pDevice->stale_releases++;
+		}
+		else if (silent >= timeout + ATMEL_STALE_PROBE_TICKS) {
+			/* same per-slot reset as a release from the controller */
+			pDevice->Flags[slot] = MXT_T9_RELEASE;
+			pDevice->EdgeContact[slot] = false;
+			pDevice->SmoothX[slot] = (LONG)pDevice->XValue[slot] << 4;
+			pDevice->SmoothY[slot] = (LONG)pDevice->YValue[slot] << 4;
+			pDevice->SmoothDx[slot] = 0;
+			pDevice->SmoothDy[slot] = 0;
+			pDevice->VelX[slot] = pDevice->VelY[slot] = 0;
+			pDevice->AccX[slot] = pDevice->AccY[slot] = 0;
+			pDevice->PredictX[slot] = pDevice->XValue[slot];
+			pDevice->PredictY[slot] = pDevice->YValue[slot];
+			pDevice->ActiveMask &= ~BIT(slot);
+			pDevice->ProbeMask &= ~BIT(slot);
+			pDevice->ReportDirty = true;
+			pDevice->stale_releases++;
+		}
+	}
+
+	if (probe) {
+		InterlockedOr(&pDevice->PendingActions, ATMEL_ACTION_REPORT_ALL);
+		WdfWorkItemEnqueue(pDevice->ProcessWorkItem);
+	}
+}
+
+/*
+* Pick the T7 power profile from how recently the capture stage saw
+* messages. Called from the timer with ContactLock held; the switch
+* itself needs the bus, so the process work item makes it.
+*/
+static void AtmelUpdatePowerProfile(PATMEL_CONTEXT pDevice) {
+	ULONGLONG quiet = KeQueryInterruptTime() - pDevice->LastActivity;
+	LONG target = quiet < (ULONGLONG)pDevice->PowerIdleTimeout * 10000 ?
+		ATMEL_POWER_PROFILE_INTERACTIVE : ATMEL_POWER_PROFILE_FACTORY;
+
+	if (target == pDevice->PowerProfileTarget)
+		return;
+
+	pDevice->PowerProfileTarget = target;
+	InterlockedOr(&pDevice->PendingActions, ATMEL_ACTION_POWER_PROFILE);
+	WdfWorkItemEnqueue(pDevice->ProcessWorkItem);
 }
 
 void AtmelTimerFunc(_In_ WDFTIMER hTimer) {
@@ -967,10 +1814,22 @@ void AtmelTimerFunc(_In_ WDFTIMER hTimer) {
 	if (!pDevice->ConnectInterrupt)
 		return;
 
+	/* polling drains the controller; the watchdog still has to run */
+	if (pDevice->PollMode)
+		WdfWorkItemEnqueue(pDevice->PollWorkItem);
+
 	if (!pDevice->RegsSet)
 		return;
 
+	WdfSpinLockAcquire(pDevice->ContactLock);
+	pDevice->WatchdogTick++;
+	if (pDevice->StaleContactTimeout)
+		AtmelCheckStaleContacts(pDevice);
+	if (pDevice->PowerIdleTimeout && pDevice->T7_size)
+		AtmelUpdatePowerProfile(pDevice);
 	AtmelProcessInput(pDevice);
+	AtmelProcessPen(pDevice);
+	WdfSpinLockRelease(pDevice->ContactLock);
 	return;
 }
 
@@ -1012,6 +1871,7 @@ AtmelEvtDeviceAdd(
 		pnpCallbacks.EvtDeviceReleaseHardware = OnReleaseHardware;
 		pnpCallbacks.EvtDeviceD0Entry = OnD0Entry;
 		pnpCallbacks.EvtDeviceD0Exit = OnD0Exit;
+		pnpCallbacks.EvtDeviceD0ExitPreInterruptsDisabled = OnD0ExitPreInterruptsDisabled;
 
 		WdfDeviceInitSetPnpPowerEventCallbacks(DeviceInit, &pnpCallbacks);
 	}
@@ -1133,7 +1993,7 @@ AtmelEvtDeviceAdd(
 	WDF_TIMER_CONFIG              timerConfig;
 	WDFTIMER                      hTimer;
 
-	WDF_TIMER_CONFIG_INIT_PERIODIC(&timerConfig, AtmelTimerFunc, 10);
+	WDF_TIMER_CONFIG_INIT_PERIODIC(&timerConfig, AtmelTimerFunc, ATMEL_TIMER_PERIOD_MS);
 
 	WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
 	attributes.ParentObject = device;
@@ -1145,6 +2005,39 @@ AtmelEvtDeviceAdd(
 		return status;
 	}
 
+	WDF_WORKITEM_CONFIG workitemConfig;
+
+	WDF_WORKITEM_CONFIG_INIT(&workitemConfig, AtmelPollWorkItem);
+
+	WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+	attributes.ParentObject = device;
+	status = WdfWorkItemCreate(&workitemConfig, &attributes, &devContext->PollWorkItem);
+	if (!NT_SUCCESS(status))
+	{
+		AtmelPrint(DEBUG_LEVEL_ERROR, DBG_PNP, "(%!FUNC!) WdfWorkItemCreate failed status:%!STATUS!\n", status);
+		return status;
+	}
+
+	WDF_WORKITEM_CONFIG_INIT(&workitemConfig, AtmelProcessWorkItem);
+
+	WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+	attributes.ParentObject = device;
+	status = WdfWorkItemCreate(&workitemConfig, &attributes, &devContext->ProcessWorkItem);
+	if (!NT_SUCCESS(status))
+	{
+		AtmelPrint(DEBUG_LEVEL_ERROR, DBG_PNP, "(%!FUNC!) WdfWorkItemCreate failed status:%!STATUS!\n", status);
+		return status;
+	}
+
+	WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+	attributes.ParentObject = device;
+	status = WdfSpinLockCreate(&attributes, &devContext->ContactLock);
+	if (!NT_SUCCESS(status))
+	{
+		AtmelPrint(DEBUG_LEVEL_ERROR, DBG_PNP, "(%!FUNC!) WdfSpinLockCreate failed status:%!STATUS!\n", status);
+		return status;
+	}
+
 	//
 	// Initialize DeviceMode
 	//
@@ -1476,13 +2369,20 @@ AtmelEvtInternalDeviceControl(
 		break;
 
 	case IOCTL_HID_READ_REPORT:
-	case IOCTL_HID_GET_INPUT_REPORT:
 		//
 		// Returns a report from the device into a class driver-supplied buffer.
 		// 
 		status = AtmelReadReport(devContext, Request, &completeRequest);
 		break;
 
+	case IOCTL_HID_GET_INPUT_REPORT:
+		//
+		// Returns the last published input report without waiting for the
+		// next touch, leaving the pending reads in the report queue alone.
+		//
+		status = AtmelGetInputReport(devContext, Request, &completeRequest);
+		break;
+
 	case IOCTL_HID_SET_FEATURE:
 		//
 		// This sends a HID class feature report to a top-level collection of
@@ -1541,6 +2441,55 @@ AtmelEvtInternalDeviceControl(
 	return;
 }
 
+static VOID
+AtmelPatchLayout(
+	IN PATMEL_CONTEXT devContext,
+	IN const ATMEL_HID_LAYOUT *Layout,
+	IN USHORT Base
+)
+{
+	PUCHAR desc = devContext->ReportDescriptor + Base;
+
+	for (USHORT i = 0; i < Layout->PatchCount; i++) {
+		desc[Layout->XMaxOffset[i]] = devContext->max_x_hid[0];
+		desc[Layout->XMaxOffset[i] + 1] = devContext->max_x_hid[1];
+		desc[Layout->YMaxOffset[i]] = devContext->max_y_hid[0];
+		desc[Layout->YMaxOffset[i] + 1] = devContext->max_y_hid[1];
+	}
+}
+
+VOID
+AtmelBuildDescriptors(
+	IN PATMEL_CONTEXT devContext
+)
+/*++
+
+Routine Description:
+
+Builds the report descriptor for the booted panel from the compile-time
+layouts, patching in the panel's logical maxima and adding the pen
+collection when stylus contacts are routed to it, and a HID descriptor
+carrying its length.
+
+--*/
+{
+	USHORT length = AtmelTouchLayout.Length;
+
+	RtlCopyMemory(devContext->ReportDescriptor, AtmelTouchLayout.Bytes, AtmelTouchLayout.Length);
+	AtmelPatchLayout(devContext, &AtmelTouchLayout, 0);
+
+	if (devContext->PenEnabled) {
+		RtlCopyMemory(devContext->ReportDescriptor + length, AtmelPenLayout.Bytes, AtmelPenLayout.Length);
+		AtmelPatchLayout(devContext, &AtmelPenLayout, length);
+		length += AtmelPenLayout.Length;
+	}
+
+	devContext->ReportDescriptorLength = length;
+
+	devContext->HidDescriptor = DefaultHidDescriptor;
+	devContext->HidDescriptor.DescriptorList[0].wReportLength = length;
+}
+
 NTSTATUS
 AtmelGetHidDescriptor(
 	IN WDFDEVICE Device,
@@ -1551,7 +2500,7 @@ AtmelGetHidDescriptor(
 	size_t              bytesToCopy = 0;
 	WDFMEMORY           memory;
 
-	UNREFERENCED_PARAMETER(Device);
+	PATMEL_CONTEXT devContext = GetDeviceContext(Device);
 
 	AtmelPrint(DEBUG_LEVEL_VERBOSE, DBG_IOCTL,
 		"AtmelGetHidDescriptor Entry\n");
@@ -1576,23 +2525,23 @@ AtmelGetHidDescriptor(
 	}
 
 	//
-	// Use hardcoded "HID Descriptor" 
+	// Use the "HID Descriptor" built at boot
 	//
-	bytesToCopy = DefaultHidDescriptor.bLength;
+	bytesToCopy = devContext->HidDescriptor.bLength;
 
 	if (bytesToCopy == 0)
 	{
 		status = STATUS_INVALID_DEVICE_STATE;
 
 		AtmelPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
-			"DefaultHidDescriptor is zero, 0x%x\n", status);
+			"HidDescriptor is zero, 0x%x\n", status);
 
 		return status;
 	}
 
 	status = WdfMemoryCopyFromBuffer(memory,
 		0, // Offset
-		(PVOID)&DefaultHidDescriptor,
+		(PVOID)&devContext->HidDescriptor,
 		bytesToCopy);
 
 	if (!NT_SUCCESS(status))
@@ -1631,36 +2580,6 @@ AtmelGetReportDescriptor(
 	AtmelPrint(DEBUG_LEVEL_VERBOSE, DBG_IOCTL,
 		"AtmelGetReportDescriptor Entry\n");
 
-#define MT_TOUCH_COLLECTION												\
-			MT_TOUCH_COLLECTION0 \
-			0x26, devContext->max_x_hid[0], devContext->max_x_hid[1],                   /*       LOGICAL_MAXIMUM (WIDTH)    */ \
-			MT_TOUCH_COLLECTION1 \
-			0x26, devContext->max_y_hid[0], devContext->max_y_hid[1],                   /*       LOGICAL_MAXIMUM (HEIGHT)    */ \
-			MT_TOUCH_COLLECTION2 \
-
-	HID_REPORT_DESCRIPTOR ReportDescriptor[] = {
-		//
-		// Multitouch report starts here
-		//
-		0x05, 0x0d,                         // USAGE_PAGE (Digitizers)
-		0x09, 0x04,                         // USAGE (Touch Screen)
-		0xa1, 0x01,                         // COLLECTION (Application)
-		0x85, REPORTID_MTOUCH,              //   REPORT_ID (Touch)
-		0x09, 0x22,                         //   USAGE (Finger)
-		MT_TOUCH_COLLECTION
-		MT_TOUCH_COLLECTION
-		MT_TOUCH_COLLECTION
-		MT_TOUCH_COLLECTION
-		MT_TOUCH_COLLECTION
-		MT_TOUCH_COLLECTION
-		MT_TOUCH_COLLECTION
-		MT_TOUCH_COLLECTION
-		MT_TOUCH_COLLECTION
-		MT_TOUCH_COLLECTION
-		USAGE_PAGE
-		0xc0,                               // END_COLLECTION
-	};
-
 	//
 	// This IOCTL is METHOD_NEITHER so WdfRequestRetrieveOutputMemory
 	// will correctly retrieve buffer from Irp->UserBuffer. 
@@ -1680,23 +2599,23 @@ AtmelGetReportDescriptor(
 	}
 
 	//
-	// Use hardcoded Report descriptor
+	// Use the Report descriptor built at boot
 	//
-	bytesToCopy = DefaultHidDescriptor.DescriptorList[0].wReportLength;
+	bytesToCopy = devContext->ReportDescriptorLength;
 
 	if (bytesToCopy == 0)
 	{
 		status = STATUS_INVALID_DEVICE_STATE;
 
 		AtmelPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
-			"DefaultHidDescriptor's reportLength is zero, 0x%x\n", status);
+			"ReportDescriptorLength is zero, 0x%x\n", status);
 
 		return status;
 	}
 
 	status = WdfMemoryCopyFromBuffer(memory,
 		0,
-		(PVOID)ReportDescriptor,
+		(PVOID)devContext->ReportDescriptor,
 		bytesToCopy);
 	if (!NT_SUCCESS(status))
 	{
@@ -1923,6 +2842,24 @@ AtmelProcessVendorReport(
 	AtmelPrint(DEBUG_LEVEL_VERBOSE, DBG_IOCTL,
 		"AtmelProcessVendorReport Entry\n");
 
+	//
+	// Every input report passes through here with ContactLock held, so
+	// keep a copy for IOCTL_HID_GET_INPUT_REPORT, whether or not a read
+	// is pending to receive it.
+	//
+
+	switch (*(PUCHAR)ReportBuffer)
+	{
+	case REPORTID_MTOUCH:
+		if (ReportBufferLen == sizeof(AtmelMultiTouchReport))
+			RtlCopyMemory(&DevContext->TouchSnapshot, ReportBuffer, ReportBufferLen);
+		break;
+	case REPORTID_PEN:
+		if (ReportBufferLen == sizeof(AtmelPenReport))
+			RtlCopyMemory(&DevContext->PenSnapshot, ReportBuffer, ReportBufferLen);
+		break;
+	}
+
 	status = WdfIoQueueRetrieveNextRequest(DevContext->ReportQueue,
 		&reqRead);
 
@@ -2230,6 +3167,101 @@ AtmelGetFeature(
 	return status;
 }
 
+NTSTATUS
+AtmelGetInputReport(
+	IN PATMEL_CONTEXT DevContext,
+	IN WDFREQUEST Request,
+	OUT BOOLEAN* CompleteRequest
+)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	WDF_REQUEST_PARAMETERS params;
+	PHID_XFER_PACKET transferPacket = NULL;
+	PVOID snapshot = NULL;
+	ULONG snapshotLen = 0;
+
+	AtmelPrint(DEBUG_LEVEL_VERBOSE, DBG_IOCTL,
+		"AtmelGetInputReport Entry\n");
+
+	WDF_REQUEST_PARAMETERS_INIT(&params);
+	WdfRequestGetParameters(Request, &params);
+
+	if (params.Parameters.DeviceIoControl.OutputBufferLength < sizeof(HID_XFER_PACKET))
+	{
+		AtmelPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
+			"AtmelGetInputReport Xfer packet too small\n");
+
+		status = STATUS_BUFFER_TOO_SMALL;
+	}
+	else
+	{
+
+		transferPacket = (PHID_XFER_PACKET)WdfRequestWdmGetIrp(Request)->UserBuffer;
+
+		if (transferPacket == NULL)
+		{
+			AtmelPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
+				"AtmelGetInputReport No xfer packet\n");
+
+			status = STATUS_INVALID_DEVICE_REQUEST;
+		}
+		else
+		{
+			//
+			// switch on the report id
+			//
+
+			switch (transferPacket->reportId)
+			{
+			case REPORTID_MTOUCH:
+				snapshot = &DevContext->TouchSnapshot;
+				snapshotLen = sizeof(AtmelMultiTouchReport);
+				break;
+
+			case REPORTID_PEN:
+				if (DevContext->PenEnabled) {
+					snapshot = &DevContext->PenSnapshot;
+					snapshotLen = sizeof(AtmelPenReport);
+				}
+				break;
+			}
+
+			if (snapshot == NULL)
+			{
+				AtmelPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
+					"AtmelGetInputReport Unhandled report type %d\n", transferPacket->reportId);
+
+				status = STATUS_INVALID_PARAMETER;
+			}
+			else if (transferPacket->reportBufferLen < snapshotLen)
+			{
+				status = STATUS_BUFFER_TOO_SMALL;
+
+				AtmelPrint(DEBUG_LEVEL_ERROR, DBG_IOCTL,
+					"AtmelGetInputReport Error transferPacket->reportBufferLen (%d) is smaller than the report (%d)\n",
+					transferPacket->reportBufferLen,
+					snapshotLen);
+			}
+			else
+			{
+				WdfSpinLockAcquire(DevContext->ContactLock);
+				RtlCopyMemory(transferPacket->reportBuffer, snapshot, snapshotLen);
+				WdfSpinLockRelease(DevContext->ContactLock);
+
+				/* nothing published yet reads as an empty report */
+				transferPacket->reportBuffer[0] = transferPacket->reportId;
+
+				WdfRequestSetInformation(Request, snapshotLen);
+			}
+		}
+	}
+
+	AtmelPrint(DEBUG_LEVEL_VERBOSE, DBG_IOCTL,
+		"AtmelGetInputReport Exit = 0x%x\n", status);
+
+	return status;
+}
+
 PCHAR
 DbgHidInternalIoctlString(
 	IN ULONG IoControlCode
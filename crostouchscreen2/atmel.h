@@ -31,107 +31,15 @@
 #define NTDEVICE_NAME_STRING       L"\\Device\\ATML0001"
 #define SYMBOLIC_NAME_STRING       L"\\DosDevices\\ATML0001"
 
-#define MT_TOUCH_COLLECTION0                                                    \
-    0xa1, 0x02,                         /*     COLLECTION (Logical)         */ \
-    0x09, 0x42,                         /*       USAGE (Tip Switch)         */ \
-    0x15, 0x00,                         /*       LOGICAL_MINIMUM (0)        */ \
-    0x25, 0x01,                         /*       LOGICAL_MAXIMUM (1)        */ \
-    0x75, 0x01,                         /*       REPORT_SIZE (1)            */ \
-    0x95, 0x01,                         /*       REPORT_COUNT (1)           */ \
-    0x81, 0x02,                         /*       INPUT (Data,Var,Abs)       */ \
-    0x09, 0x47,                         /*       USAGE (Confidence)          */ \
-    0x81, 0x02,                         /*       INPUT (Data,Var,Abs)       */ \
-    0x95, 0x06,                         /*       REPORT_COUNT (6)           */ \
-    0x81, 0x03,                         /*       INPUT (Cnst,Ary,Abs)       */ \
-    0x75, 0x08,                         /*       REPORT_SIZE (8)            */ \
-    0x09, 0x51,                         /*       USAGE (Contact Identifier) */ \
-    0x95, 0x01,                         /*       REPORT_COUNT (1)           */ \
-    0x81, 0x02,                         /*       INPUT (Data,Var,Abs)       */ \
-    0x05, 0x01,                         /*       USAGE_PAGE (Generic Desk.. */ \
-    0x75, 0x10,                         /*       REPORT_SIZE (16)           */ \
-    0x55, 0x00,                         /*       UNIT_EXPONENT (0)          */ \
-    0x65, 0x00,                         /*       UNIT (None)                */ \
-    0x35, 0x00,                         /*       PHYSICAL_MINIMUM (0)       */ \
-    0x46, 0x00, 0x00,                   /*       PHYSICAL_MAXIMUM (0)       */ 
-
-
-//0x26, 0x56, 0x05,                   /*       LOGICAL_MAXIMUM (1366)    */
-
-#define MT_TOUCH_COLLECTION1												\
-    0x09, 0x30,                         /*       USAGE (X)                  */ \
-    0x81, 0x02,                         /*       INPUT (Data,Var,Abs)       */ 
-
-//0x26, 0x00, 0x03,                   /*       LOGICAL_MAXIMUM (768)    */ 
-
-#define MT_TOUCH_COLLECTION2												\
-    0x09, 0x31,                         /*       USAGE (Y)                  */ \
-    0x81, 0x02,                         /*       INPUT (Data,Var,Abs)       */ \
-    0x05, 0x0d,                         /*       USAGE PAGE (Digitizers)    */ \
-    0x09, 0x48,                         /*       USAGE (Width)              */ \
-    0x81, 0x02,                         /*       INPUT (Data,Var,Abs)       */ \
-    0x09, 0x49,                         /*       USAGE (Height)             */ \
-    0x81, 0x02,                         /*       INPUT (Data,Var,Abs)       */ \
-    0xc0,                               /*    END_COLLECTION                */
-
-#if 0
-0x26, 0x56, 0x05,                   /*       LOGICAL_MAXIMUM (1366)    */
-0x26, 0x00, 0x03,                   /*       LOGICAL_MAXIMUM (768)    */
-#endif
-
-#define MT_REF_TOUCH_COLLECTION												\
-	MT_TOUCH_COLLECTION0 \
-	0x26, 0x00, 0x00,                   /*       LOGICAL_MAXIMUM (1366)    */ \
-	MT_TOUCH_COLLECTION1 \
-	0x26, 0x00, 0x00,                   /*       LOGICAL_MAXIMUM (768)    */ \
-	MT_TOUCH_COLLECTION2 \
-
-#define USAGE_PAGE \
-	0x05, 0x0d,                         /*    USAGE_PAGE (Digitizers) */  \
-	0x09, 0x54,                         /*    USAGE (Contact Count) */  \
-	0x95, 0x01,                         /*    REPORT_COUNT (1) */  \
-	0x75, 0x08,                         /*    REPORT_SIZE (8) */  \
-	0x15, 0x00,                         /*    LOGICAL_MINIMUM (0) */  \
-	0x25, 0x08,                         /*    LOGICAL_MAXIMUM (8) */  \
-	0x81, 0x02,                         /*    INPUT (Data,Var,Abs) */  \
-	0x09, 0x55,                         /*    USAGE(Contact Count Maximum) */  \
-	0xb1, 0x02,                         /*    FEATURE (Data,Var,Abs) */  \
-
-									//
-									// This is the default report descriptor for the Hid device provided
-									// by the mini driver in response to IOCTL_HID_GET_REPORT_DESCRIPTOR.
-									// 
-
 	typedef UCHAR HID_REPORT_DESCRIPTOR, *PHID_REPORT_DESCRIPTOR;
 
-#ifdef DESCRIPTOR_DEF
-HID_REPORT_DESCRIPTOR DefaultReportDescriptor[] = {
-	//
-	// Multitouch report starts here
-	//
-	0x05, 0x0d,                         // USAGE_PAGE (Digitizers)
-	0x09, 0x04,                         // USAGE (Touch Screen)
-	0xa1, 0x01,                         // COLLECTION (Application)
-	0x85, REPORTID_MTOUCH,              //   REPORT_ID (Touch)
-	0x09, 0x22,                         //   USAGE (Finger)
-	MT_REF_TOUCH_COLLECTION
-	MT_REF_TOUCH_COLLECTION
-	MT_REF_TOUCH_COLLECTION
-	MT_REF_TOUCH_COLLECTION
-	MT_REF_TOUCH_COLLECTION
-	MT_REF_TOUCH_COLLECTION
-	MT_REF_TOUCH_COLLECTION
-	MT_REF_TOUCH_COLLECTION
-	MT_REF_TOUCH_COLLECTION
-	MT_REF_TOUCH_COLLECTION
-	USAGE_PAGE
-	0xc0,                               // END_COLLECTION
-};
-
+#include "hiddesc.h"
 
+#ifdef DESCRIPTOR_DEF
 //
 // This is the default HID descriptor returned by the mini driver
 // in response to IOCTL_HID_GET_DEVICE_DESCRIPTOR. The size
-// of report descriptor is currently the size of DefaultReportDescriptor.
+// of report descriptor is currently the size of the touch collection.
 //
 
 CONST HID_DESCRIPTOR DefaultHidDescriptor = {
@@ -141,13 +49,221 @@ CONST HID_DESCRIPTOR DefaultHidDescriptor = {
 	0x00,   // country code == Not Specified
 	0x01,   // number of HID class descriptors
 	{ 0x22,   // descriptor type 
-	sizeof(DefaultReportDescriptor) }  // total length of report descriptor
+	AtmelTouchLayout.Length }  // total length of report descriptor
 };
 #endif
 
 #define true 1
 #define false 0
 
+//
+// Number of contact slots tracked per device
+//
+
+#define ATMEL_MAX_CONTACTS 20
+
+#define ATMEL_PEN_NONE 0xff
+
+//
+// Touch messages are decoded in structure-of-arrays batches of this size.
+// Keep it a multiple of 8 so the SIMD unpack covers whole batches.
+//
+
+#define ATMEL_DECODE_BATCH_SIZE 32
+
+typedef struct _ATMEL_DECODE_BATCH
+{
+	ULONG Count;
+
+	uint8_t Slot[ATMEL_DECODE_BATCH_SIZE];
+	uint8_t Flags[ATMEL_DECODE_BATCH_SIZE];
+	uint8_t Ampl[ATMEL_DECODE_BATCH_SIZE];
+
+	/* packed T9 position bytes, widened for the unpack */
+	uint16_t RawX[ATMEL_DECODE_BATCH_SIZE];
+	uint16_t RawY[ATMEL_DECODE_BATCH_SIZE];
+	uint16_t RawLo[ATMEL_DECODE_BATCH_SIZE];
+
+	uint16_t X[ATMEL_DECODE_BATCH_SIZE];
+	uint16_t Y[ATMEL_DECODE_BATCH_SIZE];
+
+	uint16_t Width[ATMEL_DECODE_BATCH_SIZE];
+	uint16_t Height[ATMEL_DECODE_BATCH_SIZE];
+	uint16_t Azimuth[ATMEL_DECODE_BATCH_SIZE];
+
+	/* inside an edge band */
+	uint8_t Edge[ATMEL_DECODE_BATCH_SIZE];
+} ATMEL_DECODE_BATCH;
+
+//
+// Devices without T44 size their drain reads from the largest of the
+// last ATMEL_DRAIN_WINDOW drains. Prediction errors are histogrammed in
+// buckets from -ATMEL_DRAIN_ERROR_SPAN to +ATMEL_DRAIN_ERROR_SPAN messages.
+//
+
+#define ATMEL_DRAIN_WINDOW 8
+#define ATMEL_DRAIN_ERROR_SPAN 4
+#define ATMEL_DRAIN_ERROR_BUCKETS (2 * ATMEL_DRAIN_ERROR_SPAN + 1)
+
+//
+// Interrupt storm governor. The interrupt rate is sampled over
+// ATMEL_RATE_WINDOW (100ns units); above PollThreshold interrupts per
+// second draining moves to the periodic timer until ATMEL_POLL_IDLE_EXIT
+// consecutive polls find no messages.
+//
+
+#define ATMEL_RATE_WINDOW (100 * 10000)
+#define ATMEL_DEFAULT_POLL_THRESHOLD 500
+#define ATMEL_POLL_IDLE_EXIT 10
+
+/* StormPending states; blocked from D0 exit until the next D0Entry */
+#define ATMEL_STORM_SEEN 1
+#define ATMEL_STORM_BLOCKED 2
+
+//
+// Interrupt handling is split in two stages. The capture stage (the ISR,
+// or the poll work item during a storm) only drains raw T5 messages into
+// a ring of frames; ProcessWorkItem decodes and reports them. Head and
+// tail are free running, producer and consumer are single.
+//
+
+#define ATMEL_FRAME_RING_SIZE 16
+
+typedef struct _ATMEL_FRAME
+{
+	/* performance counter at capture */
+	LARGE_INTEGER Timestamp;
+
+	/* messages following the T44 count byte in Data */
+	uint8_t Count;
+
+	uint8_t *Data;
+} ATMEL_FRAME;
+
+//
+// Follow-up work the decoder queues for the process stage to do once it
+// can use the bus again
+//
+
+#define ATMEL_ACTION_REVALIDATE_CONFIG 0x1
+#define ATMEL_ACTION_REPORT_ALL 0x2
+#define ATMEL_ACTION_POWER_PROFILE 0x4
+
+//
+// Stale contact watchdog. The periodic timer runs every
+// ATMEL_TIMER_PERIOD_MS. A contact silent for StaleContactTimeout ms gets
+// a T6 REPORTALL to confirm it; if that brings nothing within
+// ATMEL_STALE_PROBE_TICKS timer ticks, its release is synthesized. Each
+// answered probe doubles the contact's timeout, up to
+// 2^ATMEL_STALE_PROBE_BACKOFF_MAX times, so a resting finger is not
+// probed every StaleContactTimeout for as long as it rests.
+//
+
+#define ATMEL_TIMER_PERIOD_MS 10
+#define ATMEL_DEFAULT_STALE_CONTACT_TIMEOUT 1000
+#define ATMEL_STALE_PROBE_TICKS 10
+#define ATMEL_STALE_PROBE_BACKOFF_MAX 4
+
+//
+// T7 power profile governor. While the capture stage has seen messages
+// within PowerIdleTimeout ms the controller runs the interactive profile,
+// acquiring every InteractiveInterval ms in both idle and active mode;
+// after that the factory T7 values read at boot are restored.
+//
+
+#define ATMEL_POWER_PROFILE_FACTORY 0
+#define ATMEL_POWER_PROFILE_INTERACTIVE 1
+
+#define ATMEL_DEFAULT_POWER_IDLE_TIMEOUT 3000
+#define ATMEL_DEFAULT_INTERACTIVE_INTERVAL 10
+
+//
+// Default T100 touch type policy: large touches (palms) are reported
+// without Confidence and hovering fingers are not reported at all
+//
+
+#define ATMEL_DEFAULT_LOW_CONFIDENCE_TYPES BIT(MXT_T100_TYPE_LARGE_TOUCH)
+#define ATMEL_DEFAULT_SUPPRESSED_TYPES BIT(MXT_T100_TYPE_HOVERING_FINGER)
+
+//
+// In delta mode a touch report is only sent when a contact changed tip
+// state or moved more than DeltaThreshold since it was last reported, or
+// after FullFrameInterval frames of smaller motion were held back. Every
+// report still carries every live contact, so this lowers the report
+// rate, not the report size. Held back motion stays pending until sent.
+//
+
+#define ATMEL_DEFAULT_FULL_FRAME_INTERVAL 10
+
+//
+// Resting contacts hold their position until they move more than this
+// many thousandths of the panel range on either axis
+//
+
+#define ATMEL_DEFAULT_HYSTERESIS 2
+
+//
+// Adaptive smoothing in the style of the 1 euro filter. Positions are
+// filtered in Q4 with a Q8 weight looked up by contact speed (counts per
+// sample, from a derivative smoothed with ATMEL_SMOOTH_DERIVATIVE_ALPHA).
+// SmoothMinCutoff and SmoothBeta give the cutoff as 256 * 2 pi fc Te at
+// rest and its rise per count per sample. Off unless Smoothing is set.
+//
+
+#define ATMEL_SMOOTH_SPEEDS 64
+#define ATMEL_SMOOTH_DERIVATIVE_ALPHA 64
+#define ATMEL_DEFAULT_SMOOTH_MIN_CUTOFF 64
+#define ATMEL_DEFAULT_SMOOTH_BETA 32
+
+//
+// Position prediction extrapolates each contact by PredictionHorizon ms
+// from its smoothed velocity and acceleration per sample. Samples are
+// assumed ATMEL_DEFAULT_ACQUISITION_INTERVAL ms apart unless T7 says
+// otherwise (0 and 255 are not intervals).
+//
+
+#define ATMEL_DEFAULT_ACQUISITION_INTERVAL 20
+
+//
+// Mounting and calibration transform, a 2x3 matrix in Q16:
+//   x' = XX x + XY y + X0 (max x' - 1)
+//   y' = YX x + YY y + Y0 (max y' - 1)
+// The offsets are fractions of the output range so the same values work
+// on any panel. Pure swaps and flips are recognized and take an integer
+// path that matches the general one exactly.
+//
+
+#define ATMEL_TRANSFORM_ONE 0x10000
+
+//
+// Edge rejection: contacts touching down within EdgeBand thousandths of
+// the range from any edge are reported without Confidence, or not at all
+//
+
+#define ATMEL_EDGE_OFF 0
+#define ATMEL_EDGE_LOW_CONFIDENCE 1
+#define ATMEL_EDGE_SUPPRESS 2
+
+enum {
+	ATMEL_TRANSFORM_IDENTITY,
+	ATMEL_TRANSFORM_ORTHOGONAL,
+	ATMEL_TRANSFORM_AFFINE,
+};
+
+enum {
+	ATMEL_TRANSFORM_XX,
+	ATMEL_TRANSFORM_XY,
+	ATMEL_TRANSFORM_X0,
+	ATMEL_TRANSFORM_YX,
+	ATMEL_TRANSFORM_YY,
+	ATMEL_TRANSFORM_Y0,
+	ATMEL_TRANSFORM_TERMS
+};
+
+struct _ATMEL_CONTEXT;
+
+typedef int (*PATMEL_DECODE_ROUTINE)(struct _ATMEL_CONTEXT *pDevice, uint8_t *msg_buf, int count);
+
 typedef struct _ATMEL_CONTEXT
 {
 
@@ -171,6 +287,24 @@ typedef struct _ATMEL_CONTEXT
 
 	WDFTIMER Timer;
 
+	WDFWORKITEM PollWorkItem;
+
+	WDFWORKITEM ProcessWorkItem;
+
+	/* guards contact state between the process stage and the timer */
+	WDFSPINLOCK ContactLock;
+
+	ULONG PollThreshold;
+
+	BOOLEAN PollMode;
+
+	/* ATMEL_STORM_SEEN: the ISR saw a storm, the poll work item has yet to mask it */
+	volatile LONG StormPending;
+
+	volatile LONG PollRunning;
+
+	BOOLEAN InterruptMasked;
+
 	mxt_message_t lastmsg;
 
 	mxt_rollup core;
@@ -182,13 +316,158 @@ typedef struct _ATMEL_CONTEXT
 
 	UINT32 TouchCount;
 
-	uint8_t      Flags[20];
-
-	USHORT    XValue[20];
-
-	USHORT    YValue[20];
-
-	USHORT    AREA[20];
+	uint8_t      Flags[ATMEL_MAX_CONTACTS];
+
+	BOOLEAN      Confident[ATMEL_MAX_CONTACTS];
+
+	/* T100 passive stylus contacts go to a separate pen collection */
+	BOOLEAN      PenEnabled;
+	uint8_t      PenSlot;
+
+	/* latest pen state, dirty until a read takes it */
+	AtmelPenReport PenReport;
+	BOOLEAN      PenDirty;
+
+	/* last published reports, served to IOCTL_HID_GET_INPUT_REPORT */
+	AtmelMultiTouchReport TouchSnapshot;
+	AtmelPenReport PenSnapshot;
+
+	USHORT    XValue[ATMEL_MAX_CONTACTS];
+
+	USHORT    YValue[ATMEL_MAX_CONTACTS];
+
+	USHORT    WIDTH[ATMEL_MAX_CONTACTS];
+
+	USHORT    HEIGHT[ATMEL_MAX_CONTACTS];
+
+	USHORT    AZIMUTH[ATMEL_MAX_CONTACTS];
+
+	USHORT    PRESSURE[ATMEL_MAX_CONTACTS];
+
+	/* amplitude to Tip Pressure, built from the Pressure* settings */
+	USHORT    PressureLut[256];
+	ULONG     PressureMin;
+	ULONG     PressureMax;
+	ULONG     PressureCurve;
+
+	/* T100 touch type policy, bit n set applies to type n */
+	ULONG     LowConfidenceTypes;
+	ULONG     SuppressedTypes;
+	ULONG     low_confidence_contacts;
+	ULONG     suppressed_contacts;
+
+	/* changed-contacts-only reporting, and what each slot last reported */
+	BOOLEAN   DeltaReports;
+	ULONG     DeltaThreshold;
+	ULONG     FullFrameInterval;
+	ULONG     FramesSinceFull;
+	USHORT    ReportedX[ATMEL_MAX_CONTACTS];
+	USHORT    ReportedY[ATMEL_MAX_CONTACTS];
+	BYTE      ReportedStatus[ATMEL_MAX_CONTACTS];
+
+	/*
+	* Stationary jitter hysteresis, in thousandths of the panel range, and
+	* the resulting per axis freeze distance. ReportDirty is set when a
+	* contact's position or state changes and cleared once a report with
+	* it has been delivered.
+	*/
+	ULONG     Hysteresis;
+	USHORT    FuzzX;
+	USHORT    FuzzY;
+	BOOLEAN   ReportDirty;
+	ULONG     jitter_frozen;
+	ULONG     reports_skipped;
+
+	/* adaptive smoothing, Q4 positions and speeds per contact */
+	BOOLEAN   Smoothing;
+	ULONG     SmoothMinCutoff;
+	ULONG     SmoothBeta;
+	USHORT    SmoothAlphaLut[ATMEL_SMOOTH_SPEEDS];
+	LONG      SmoothX[ATMEL_MAX_CONTACTS];
+	LONG      SmoothY[ATMEL_MAX_CONTACTS];
+	LONG      SmoothDx[ATMEL_MAX_CONTACTS];
+	LONG      SmoothDy[ATMEL_MAX_CONTACTS];
+
+	/* prediction, Q4 velocity and acceleration per sample */
+	ULONG     PredictionHorizon;
+	uint8_t   AcquisitionInterval;
+	LONG      VelX[ATMEL_MAX_CONTACTS];
+	LONG      VelY[ATMEL_MAX_CONTACTS];
+	LONG      AccX[ATMEL_MAX_CONTACTS];
+	LONG      AccY[ATMEL_MAX_CONTACTS];
+	USHORT    PredictX[ATMEL_MAX_CONTACTS];
+	USHORT    PredictY[ATMEL_MAX_CONTACTS];
+
+	/* coordinate transform from the registry and its boot time form */
+	LONG      Transform[ATMEL_TRANSFORM_TERMS];
+	uint8_t   TransformKind;
+	BOOLEAN   TransformSwap;
+	BOOLEAN   TransformFlipX;
+	BOOLEAN   TransformFlipY;
+	LONGLONG  TransformXOffset;
+	LONGLONG  TransformYOffset;
+
+	/* edge rejection, bands in reported coordinates */
+	ULONG     EdgeRejection;
+	ULONG     EdgeBand;
+	USHORT    EdgeMinX;
+	USHORT    EdgeMaxX;
+	USHORT    EdgeMinY;
+	USHORT    EdgeMaxY;
+	BOOLEAN   EdgeContact[ATMEL_MAX_CONTACTS];
+	ULONG     edge_rejected_contacts;
+
+	/* stale contact watchdog, bit n tracks slot n */
+	ULONG     StaleContactTimeout;
+	ULONG     WatchdogTick;
+	ULONG     ActiveMask;
+	ULONG     ProbeMask;
+	ULONG     LastUpdate[ATMEL_MAX_CONTACTS];
+	UCHAR     ProbeBackoff[ATMEL_MAX_CONTACTS];
+	ULONG     stale_probes;
+	ULONG     stale_releases;
+
+	/* T7 power profile governor */
+	ULONG     PowerIdleTimeout;
+	ULONG     InteractiveInterval;
+	LONG      PowerProfile;
+	LONG      PowerProfileTarget;
+	volatile LONGLONG LastActivity;
+	ULONG     power_profile_switches;
+
+	/*
+	* T100 contact geometry: side of a square of the reported area in
+	* pixels, and per vector byte the Q12 stretch of the major and minor
+	* axes and the axis orientation in degrees
+	*/
+	USHORT    AreaSideLut[256];
+	USHORT    VectMajorLut[256];
+	USHORT    VectMinorLut[256];
+	USHORT    VectAzimuthLut[256];
+
+	ATMEL_DECODE_BATCH DecodeBatch;
+
+	/* decoder specialized for this device, chosen at boot */
+	PATMEL_DECODE_ROUTINE DecodeMessages;
+
+	/* backing store for the frame drain buffers */
+	uint8_t *MsgBuf;
+
+	ATMEL_FRAME Frames[ATMEL_FRAME_RING_SIZE];
+	volatile LONG FrameHead;
+	volatile LONG FrameTail;
+
+	/* owned by the one process work item run draining the ring */
+	volatile LONG ProcessRunning;
+
+	ATMEL_FRAME ScratchFrame;
+
+	/* pipeline statistics, in performance counter ticks */
+	LONGLONG capture_ticks;
+	LONGLONG queue_ticks;
+	LONGLONG process_ticks;
+	ULONG frames_processed;
+	ULONG frames_dropped;
 
 	uint16_t max_x;
 	uint16_t max_y;
@@ -196,6 +475,11 @@ typedef struct _ATMEL_CONTEXT
 	uint8_t max_x_hid[2];
 	uint8_t max_y_hid[2];
 
+	/* descriptors built at boot for this panel */
+	HID_DESCRIPTOR HidDescriptor;
+	HID_REPORT_DESCRIPTOR ReportDescriptor[ATMEL_MAX_REPORT_DESCRIPTOR];
+	USHORT ReportDescriptorLength;
+
 	uint8_t num_touchids;
 	uint8_t multitouch;
 
@@ -208,9 +492,13 @@ typedef struct _ATMEL_CONTEXT
 	/* Cached parameters from object table */
 	uint16_t T5_address;
 	uint8_t T5_msg_size;
+	BOOLEAN MessageCrc;
+	ULONG crc_errors;
 	uint8_t T6_reportid;
 	uint16_t T6_address;
 	uint16_t T7_address;
+	uint8_t T7_size;
+	uint8_t T7_shadow[8];
 	uint8_t T9_reportid_min;
 	uint8_t T9_reportid_max;
 	uint8_t T19_reportid;
@@ -220,9 +508,28 @@ typedef struct _ATMEL_CONTEXT
 
 	uint8_t max_reportid;
 
-	uint8_t last_message_count;
-
-	uint8_t interrupt_count;
+	/* T6 status tracking */
+	uint32_t config_crc;
+	BOOLEAN ConfigCrcValid;
+	volatile LONG PendingActions;
+	volatile LONG DrainReset;
+	LARGE_INTEGER RecoveryStart;
+	LONGLONG recovery_ticks;
+	ULONG t6_resets;
+	ULONG t6_overflows;
+	ULONG t6_config_errors;
+
+	uint8_t drain_history[ATMEL_DRAIN_WINDOW];
+	uint8_t drain_history_pos;
+	ULONG drain_error_hist[ATMEL_DRAIN_ERROR_BUCKETS];
+
+	/* storm governor state and statistics */
+	ULONG interrupt_count;
+	ULONG interrupt_rate;
+	ULONGLONG rate_window_start;
+	uint8_t poll_idle_count;
+	ULONG poll_entries;
+	ULONG poll_exits;
 
 } ATMEL_CONTEXT, *PATMEL_CONTEXT;
 
@@ -315,6 +622,13 @@ AtmelGetFeature(
 	OUT BOOLEAN* CompleteRequest
 );
 
+NTSTATUS
+AtmelGetInputReport(
+	IN PATMEL_CONTEXT DevContext,
+	IN WDFREQUEST Request,
+	OUT BOOLEAN* CompleteRequest
+);
+
 PCHAR
 DbgHidInternalIoctlString(
 	IN ULONG        IoControlCode
@@ -325,6 +639,55 @@ AtmelCompleteIdleIrp(
 	IN PATMEL_CONTEXT FxDeviceContext
 );
 
+VOID
+AtmelBuildDescriptors(
+	IN PATMEL_CONTEXT devContext
+);
+
+VOID
+AtmelBuildPressureLut(
+	IN PATMEL_CONTEXT pDevice
+);
+
+VOID
+AtmelBuildSmoothingLut(
+	IN PATMEL_CONTEXT pDevice
+);
+
+VOID
+AtmelSelectDecoder(
+	IN PATMEL_CONTEXT pDevice
+);
+
+int
+AtmelCountMessages(
+	IN PATMEL_CONTEXT pDevice,
+	IN uint8_t *msg_buf,
+	IN int count
+);
+
+int
+AtmelProcessMessages(
+	IN PATMEL_CONTEXT pDevice,
+	IN uint8_t *msg_buf,
+	IN int count
+);
+
+BOOLEAN
+AtmelProcessInput(
+	IN PATMEL_CONTEXT pDevice
+);
+
+BOOLEAN
+AtmelProcessPen(
+	IN PATMEL_CONTEXT pDevice
+);
+
+void
+AtmelReleasePen(
+	IN PATMEL_CONTEXT pDevice
+);
+
 //
 // Helper macros
 //
@@ -181,6 +181,9 @@ __packed(struct mxt_message_touch_t9 {
 #define MXT_T9_ORIENT		9
 #define MXT_T9_RANGE		18
 
+/* Setting the address MSB asks the controller to append a CRC8 to each T5 message */
+#define MXT_T5_CRC_READ		0x8000
+
 /* MXT_TOUCH_MULTI_T9 status */
 #define MXT_T9_UNGRIP		(1 << 0)
 #define MXT_T9_SUPPRESS		(1 << 1)
@@ -628,5 +631,6 @@ struct atmel_softc {
 */
 uint32_t obp_convert_crc(struct mxt_raw_crc *crc);
 uint32_t obp_crc24(uint8_t *buf, size_t bytes);
+uint8_t obp_crc8(const uint8_t *buf, size_t bytes);
 
 #endif
\ No newline at end of file
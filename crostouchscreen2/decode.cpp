@@ -0,0 +1,986 @@
+/*++
+
+Module Name:
+
+decode.cpp
+
+Abstract:
+
+Batched decoding of drained T5 message buffers. Touch messages are
+gathered into a structure-of-arrays staging block, their packed
+coordinates are unpacked for the whole block at once (SSE2/NEON where
+available), and the results are then applied to the contact state.
+
+Environment:
+
+Kernel mode
+
+--*/
+
+#include "atmel.h"
+
+#if defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define ATMEL_DECODE_SSE2
+#elif defined(_M_ARM64)
+#include <arm64_neon.h>
+#define ATMEL_DECODE_NEON
+#endif
+
+static ULONG AtmelDebugLevel = 100;
+static ULONG AtmelDebugCatagories = DBG_INIT || DBG_PNP || DBG_IOCTL;
+
+/*
+* T9 packs 12-bit positions as xxxxxxxx(hi) yyyyyyyy(hi) xxxxyyyy(lo).
+* Parts configured for a range under 1024 report 10-bit data in the
+* top bits, so the whole lane is shifted down by two.
+*/
+template <int XShift, int YShift>
+static void
+AtmelUnpackT9(ATMEL_DECODE_BATCH *batch)
+{
+	ULONG i = 0;
+
+#if defined(ATMEL_DECODE_SSE2)
+	const __m128i loMask = _mm_set1_epi16(0x000f);
+
+	for (; i + 8 <= batch->Count; i += 8) {
+		__m128i xhi = _mm_loadu_si128((const __m128i *)&batch->RawX[i]);
+		__m128i yhi = _mm_loadu_si128((const __m128i *)&batch->RawY[i]);
+		__m128i lo = _mm_loadu_si128((const __m128i *)&batch->RawLo[i]);
+
+		__m128i x = _mm_or_si128(_mm_slli_epi16(xhi, 4), _mm_srli_epi16(lo, 4));
+		__m128i y = _mm_or_si128(_mm_slli_epi16(yhi, 4), _mm_and_si128(lo, loMask));
+
+		_mm_storeu_si128((__m128i *)&batch->X[i], _mm_srli_epi16(x, XShift));
+		_mm_storeu_si128((__m128i *)&batch->Y[i], _mm_srli_epi16(y, YShift));
+	}
+#elif defined(ATMEL_DECODE_NEON)
+	const uint16x8_t loMask = vdupq_n_u16(0x000f);
+	const int16x8_t xs = vdupq_n_s16(-XShift);
+	const int16x8_t ys = vdupq_n_s16(-YShift);
+
+	for (; i + 8 <= batch->Count; i += 8) {
+		uint16x8_t xhi = vld1q_u16(&batch->RawX[i]);
+		uint16x8_t yhi = vld1q_u16(&batch->RawY[i]);
+		uint16x8_t lo = vld1q_u16(&batch->RawLo[i]);
+
+		uint16x8_t x = vorrq_u16(vshlq_n_u16(xhi, 4), vshrq_n_u16(lo, 4));
+		uint16x8_t y = vorrq_u16(vshlq_n_u16(yhi, 4), vandq_u16(lo, loMask));
+
+		vst1q_u16(&batch->X[i], vshlq_u16(x, xs));
+		vst1q_u16(&batch->Y[i], vshlq_u16(y, ys));
+	}
+#endif
+
+	for (; i < batch->Count; i++) {
+		uint16_t x = (uint16_t)((batch->RawX[i] << 4) | (batch->RawLo[i] >> 4));
+		uint16_t y = (uint16_t)((batch->RawY[i] << 4) | (batch->RawLo[i] & 0xf));
+
+		batch->X[i] = x >> XShift;
+		batch->Y[i] = y >> YShift;
+	}
+}
+
+/*
+* Map decoded positions through the mounting and calibration transform.
+* The identity never gets here, swaps and flips stay in integer compares.
+*/
+static void
+AtmelTransformBatch(PATMEL_CONTEXT pDevice, ATMEL_DECODE_BATCH *batch)
+{
+	const LONG max_x = pDevice->max_x - 1;
+	const LONG max_y = pDevice->max_y - 1;
+
+	if (pDevice->TransformKind == ATMEL_TRANSFORM_ORTHOGONAL) {
+		for (ULONG i = 0; i < batch->Count; i++) {
+			LONG x = batch->X[i];
+			LONG y = batch->Y[i];
+
+			if (pDevice->TransformSwap) {
+				LONG t = x;
+				x = y;
+				y = t;
+			}
+			if (pDevice->TransformFlipX)
+				x = max_x - x;
+			if (pDevice->TransformFlipY)
+				y = max_y - y;
+
+			batch->X[i] = (uint16_t)max(0, min(x, max_x));
+			batch->Y[i] = (uint16_t)max(0, min(y, max_y));
+		}
+		return;
+	}
+
+	const LONG *m = pDevice->Transform;
+
+	for (ULONG i = 0; i < batch->Count; i++) {
+		LONGLONG x = batch->X[i];
+		LONGLONG y = batch->Y[i];
+		LONGLONG tx = (m[ATMEL_TRANSFORM_XX] * x + m[ATMEL_TRANSFORM_XY] * y + pDevice->TransformXOffset) >> 16;
+		LONGLONG ty = (m[ATMEL_TRANSFORM_YX] * x + m[ATMEL_TRANSFORM_YY] * y + pDevice->TransformYOffset) >> 16;
+
+		batch->X[i] = (uint16_t)max(0, min(tx, (LONGLONG)max_x));
+		batch->Y[i] = (uint16_t)max(0, min(ty, (LONGLONG)max_y));
+	}
+}
+
+/*
+* Pen reports go out as soon as each stylus message is decoded rather
+* than with the finger frame, so inking sees no frame batching. The state
+* stays dirty until a read takes it, and the timer retries until then.
+*/
+static void
+AtmelReportPen(PATMEL_CONTEXT pDevice, ATMEL_DECODE_BATCH *batch, ULONG i, bool down)
+{
+	AtmelPenReport *report = &pDevice->PenReport;
+
+	report->ReportID = REPORTID_PEN;
+	report->Status = down ? (PEN_TIPSWITCH_BIT | PEN_INRANGE_BIT) : 0;
+	report->XValue = batch->X[i];
+	report->YValue = batch->Y[i];
+	report->Pressure = down ? pDevice->PressureLut[batch->Ampl[i]] : 0;
+
+	pDevice->PenDirty = true;
+	AtmelProcessPen(pDevice);
+}
+
+/*
+* Note a message about a contact for the stale contact watchdog, which
+* only walks contacts that are down. A contact that answered a probe is
+* resting, so it is probed less often; a new press starts over at the
+* configured timeout.
+*/
+static void
+AtmelMarkContactSeen(PATMEL_CONTEXT pDevice, uint8_t slot, bool down, bool was_down)
+{
+	if (down && !was_down)
+		pDevice->ProbeBackoff[slot] = 0;
+	else if ((pDevice->ProbeMask & BIT(slot)) &&
+		pDevice->ProbeBackoff[slot] < ATMEL_STALE_PROBE_BACKOFF_MAX)
+		pDevice->ProbeBackoff[slot]++;
+	pDevice->LastUpdate[slot] = pDevice->WatchdogTick;
+	pDevice->ProbeMask &= ~BIT(slot);
+	if (down)
+		pDevice->ActiveMask |= BIT(slot);
+	else
+		pDevice->ActiveMask &= ~BIT(slot);
+}
+
+/*
+* One adaptive smoothing step for a contact that stays down. The weight
+* given to the new sample rises with speed, so a slow contact is smoothed
+* hard and a fast one follows closely.
+*/
+static void
+AtmelSmoothContact(PATMEL_CONTEXT pDevice, uint8_t slot, uint16_t *x, uint16_t *y)
+{
+	LONG rx = (LONG)*x << 4;
+	LONG ry = (LONG)*y << 4;
+	LONG dx = pDevice->SmoothDx[slot];
+	LONG dy = pDevice->SmoothDy[slot];
+
+	dx += ((rx - pDevice->SmoothX[slot] - dx) * ATMEL_SMOOTH_DERIVATIVE_ALPHA) >> 8;
+	dy += ((ry - pDevice->SmoothY[slot] - dy) * ATMEL_SMOOTH_DERIVATIVE_ALPHA) >> 8;
+	pDevice->SmoothDx[slot] = dx;
+	pDevice->SmoothDy[slot] = dy;
+
+	ULONG speed = (ULONG)max(max(dx, -dx), max(dy, -dy)) >> 4;
+	LONG alpha = pDevice->SmoothAlphaLut[min(speed, ATMEL_SMOOTH_SPEEDS - 1)];
+
+	pDevice->SmoothX[slot] += ((rx - pDevice->SmoothX[slot]) * alpha) >> 8;
+	pDevice->SmoothY[slot] += ((ry - pDevice->SmoothY[slot]) * alpha) >> 8;
+
+	*x = (uint16_t)((pDevice->SmoothX[slot] + 8) >> 4);
+	*y = (uint16_t)((pDevice->SmoothY[slot] + 8) >> 4);
+}
+
+/*
+* Extrapolate a contact that stays down by the prediction horizon,
+* clamped to the last coordinate on the panel. Velocity and acceleration
+* are smoothed over a couple of samples so a single noisy step does not
+* throw the contact.
+*/
+static void
+AtmelPredictContact(PATMEL_CONTEXT pDevice, uint8_t slot, uint16_t x, uint16_t y)
+{
+	ULONG interval = pDevice->AcquisitionInterval;
+	LONG vx = pDevice->VelX[slot];
+	LONG vy = pDevice->VelY[slot];
+
+	if (interval == 0 || interval == 0xff)
+		interval = ATMEL_DEFAULT_ACQUISITION_INTERVAL;
+
+	vx += (((LONG)(x - pDevice->XValue[slot]) << 4) - vx) >> 1;
+	vy += (((LONG)(y - pDevice->YValue[slot]) << 4) - vy) >> 1;
+	pDevice->AccX[slot] += ((vx - pDevice->VelX[slot]) - pDevice->AccX[slot]) >> 1;
+	pDevice->AccY[slot] += ((vy - pDevice->VelY[slot]) - pDevice->AccY[slot]) >> 1;
+	pDevice->VelX[slot] = vx;
+	pDevice->VelY[slot] = vy;
+
+	/* horizon in Q8 samples, offsets in Q4 counts: v h + a h^2 / 2 */
+	LONGLONG h = ((LONGLONG)pDevice->PredictionHorizon << 8) / interval;
+	LONGLONG px = ((LONGLONG)x << 4) + ((vx * h) >> 8) + ((pDevice->AccX[slot] * h * h) >> 17);
+	LONGLONG py = ((LONGLONG)y << 4) + ((vy * h) >> 8) + ((pDevice->AccY[slot] * h * h) >> 17);
+
+	pDevice->PredictX[slot] = (USHORT)max(0, min((px + 8) >> 4, (LONGLONG)pDevice->max_x - 1));
+	pDevice->PredictY[slot] = (USHORT)max(0, min((py + 8) >> 4, (LONGLONG)pDevice->max_y - 1));
+}
+
+/*
+* Flag the batch entries that lie inside the edge bands.
+*/
+static void
+AtmelClassifyEdges(PATMEL_CONTEXT pDevice, ATMEL_DECODE_BATCH *batch)
+{
+	const uint16_t lo_x = pDevice->EdgeMinX, hi_x = pDevice->EdgeMaxX;
+	const uint16_t lo_y = pDevice->EdgeMinY, hi_y = pDevice->EdgeMaxY;
+
+	for (ULONG i = 0; i < batch->Count; i++) {
+		uint16_t x = batch->X[i];
+		uint16_t y = batch->Y[i];
+
+		batch->Edge[i] = (x < lo_x) | (x > hi_x) | (y < lo_y) | (y > hi_y);
+	}
+}
+
+template <bool IsT100>
+static void
+AtmelApplyBatch(PATMEL_CONTEXT pDevice, ATMEL_DECODE_BATCH *batch)
+{
+	for (ULONG i = 0; i < batch->Count; i++) {
+		uint8_t slot = batch->Slot[i];
+		uint8_t flags = batch->Flags[i];
+		bool low_confidence = false;
+
+		if (IsT100) {
+			ULONG type = BIT((flags & MXT_T100_TYPE_MASK) >> 4);
+			bool detect = (flags & MXT_T100_DETECT) != 0;
+
+			/* suppressed types (hover by default) are never reported down */
+			if (detect && (pDevice->SuppressedTypes & type)) {
+				pDevice->suppressed_contacts++;
+				detect = false;
+			}
+
+			low_confidence = detect && (pDevice->LowConfidenceTypes & type);
+
+			/*
+			* A contact that touches down as a passive stylus belongs to
+			* the pen collection until it lifts. Only one pen is tracked.
+			*/
+			if (pDevice->PenSlot == slot) {
+				AtmelReportPen(pDevice, batch, i, detect);
+				AtmelMarkContactSeen(pDevice, slot, detect, true);
+				if (!detect)
+					pDevice->PenSlot = ATMEL_PEN_NONE;
+				continue;
+			}
+
+			/*
+			* An undelivered lift is not overwritten by the next pen; the
+			* stylus is picked up again with a later message.
+			*/
+			if (pDevice->PenEnabled && detect &&
+				type == BIT(MXT_T100_TYPE_PASSIVE_STYLUS) &&
+				pDevice->PenSlot == ATMEL_PEN_NONE &&
+				!(pDevice->Flags[slot] & MXT_T9_DETECT) &&
+				AtmelProcessPen(pDevice)) {
+				pDevice->PenSlot = slot;
+				AtmelReportPen(pDevice, batch, i, true);
+				AtmelMarkContactSeen(pDevice, slot, true, false);
+				continue;
+			}
+
+			uint8_t t9_flags = 0; //convert T100 flags to T9
+			if (detect)
+				t9_flags += MXT_T9_DETECT;
+			else if (pDevice->Flags[slot] & MXT_T100_DETECT)
+				t9_flags += MXT_T9_RELEASE;
+			flags = t9_flags;
+		}
+
+		/*
+		* A lift is only forgotten once a delivered report carried it, so
+		* a message without a touch leaves an undelivered one pending.
+		*/
+		if (!(flags & (MXT_T9_DETECT | MXT_T9_PRESS)))
+			flags |= pDevice->Flags[slot] & MXT_T9_RELEASE;
+
+		/*
+		* A contact that touches down inside an edge band stays under the
+		* edge policy until it lifts, wherever it moves. Suppressed ones
+		* are never stored, so there is no release to send for them.
+		*/
+		if (pDevice->EdgeRejection) {
+			bool down = (flags & (MXT_T9_DETECT | MXT_T9_PRESS)) != 0;
+			bool was_down = (pDevice->Flags[slot] & (MXT_T9_DETECT | MXT_T9_PRESS)) != 0;
+
+			if (down && !was_down && !pDevice->EdgeContact[slot] && batch->Edge[i]) {
+				pDevice->EdgeContact[slot] = true;
+				pDevice->edge_rejected_contacts++;
+			}
+
+			bool edge = pDevice->EdgeContact[slot] != 0;
+			if (!down)
+				pDevice->EdgeContact[slot] = false;
+
+			if (edge) {
+				if (pDevice->EdgeRejection == ATMEL_EDGE_SUPPRESS)
+					continue;
+				low_confidence = low_confidence || down;
+			}
+		}
+
+		/*
+		* A slot released and reused within one drain must still
+		* show the lift, so flush the pending release first. If no
+		* read takes it, the lift stays pending ahead of the new
+		* contact and the flush is retried with the next message.
+		*/
+		if ((pDevice->Flags[slot] & MXT_T9_RELEASE) &&
+			(flags & (MXT_T9_DETECT | MXT_T9_PRESS)) &&
+			!AtmelProcessInput(pDevice))
+			flags |= MXT_T9_RELEASE;
+
+		/*
+		* Confidence is per contact: once dropped it stays dropped until
+		* the lift, which the OS then treats as a cancel.
+		*/
+		if (!(pDevice->Flags[slot] & (MXT_T9_DETECT | MXT_T9_PRESS)))
+			pDevice->Confident[slot] = true;
+		bool dropped = low_confidence && pDevice->Confident[slot];
+		if (dropped) {
+			pDevice->low_confidence_contacts++;
+			pDevice->Confident[slot] = false;
+		}
+
+		/*
+		* Smoothing, then hysteresis: a resting contact keeps its position
+		* until it moves past the hysteresis distance, so sensor jitter
+		* neither moves it nor makes a report. Presses and lifts always
+		* take the new sample.
+		*/
+		bool down = (flags & (MXT_T9_DETECT | MXT_T9_PRESS)) != 0;
+		bool was_down = (pDevice->Flags[slot] & (MXT_T9_DETECT | MXT_T9_PRESS)) != 0;
+		uint16_t x = batch->X[i];
+		uint16_t y = batch->Y[i];
+
+		if (pDevice->Smoothing) {
+			if (down && was_down) {
+				AtmelSmoothContact(pDevice, slot, &x, &y);
+			}
+			else {
+				/* every press starts the filter over at the new sample */
+				pDevice->SmoothX[slot] = (LONG)x << 4;
+				pDevice->SmoothY[slot] = (LONG)y << 4;
+				pDevice->SmoothDx[slot] = 0;
+				pDevice->SmoothDy[slot] = 0;
+			}
+		}
+
+		if (down && was_down) {
+			int dx = x - pDevice->XValue[slot];
+			int dy = y - pDevice->YValue[slot];
+
+			if (dx <= pDevice->FuzzX && -dx <= pDevice->FuzzX &&
+				dy <= pDevice->FuzzY && -dy <= pDevice->FuzzY) {
+				if (dx != 0 || dy != 0)
+					pDevice->jitter_frozen++;
+				x = pDevice->XValue[slot];
+				y = pDevice->YValue[slot];
+			}
+		}
+
+		if (down != was_down || (flags & MXT_T9_RELEASE) || dropped ||
+			x != pDevice->XValue[slot] || y != pDevice->YValue[slot])
+			pDevice->ReportDirty = true;
+
+		/* presses and lifts are reported where they happened */
+		if (pDevice->PredictionHorizon && down && was_down) {
+			AtmelPredictContact(pDevice, slot, x, y);
+		}
+		else {
+			pDevice->VelX[slot] = pDevice->VelY[slot] = 0;
+			pDevice->AccX[slot] = pDevice->AccY[slot] = 0;
+			pDevice->PredictX[slot] = x;
+			pDevice->PredictY[slot] = y;
+		}
+
+		pDevice->Flags[slot] = flags;
+		pDevice->XValue[slot] = x;
+		pDevice->YValue[slot] = y;
+
+		AtmelMarkContactSeen(pDevice, slot, down, was_down);
+		pDevice->WIDTH[slot] = batch->Width[i];
+		pDevice->HEIGHT[slot] = batch->Height[i];
+		pDevice->AZIMUTH[slot] = batch->Azimuth[i];
+		pDevice->PRESSURE[slot] = pDevice->PressureLut[batch->Ampl[i]];
+	}
+
+	batch->Count = 0;
+}
+
+template <bool IsT100, int XShift, int YShift>
+static void
+AtmelFlushBatch(PATMEL_CONTEXT pDevice, ATMEL_DECODE_BATCH *batch)
+{
+	if (batch->Count == 0)
+		return;
+
+	if (!IsT100)
+		AtmelUnpackT9<XShift, YShift>(batch);
+	if (pDevice->TransformKind != ATMEL_TRANSFORM_IDENTITY)
+		AtmelTransformBatch(pDevice, batch);
+	if (pDevice->EdgeRejection)
+		AtmelClassifyEdges(pDevice, batch);
+	AtmelApplyBatch<IsT100>(pDevice, batch);
+}
+
+/*
+* Lift every tracked contact in a single report.
+*/
+static void
+AtmelReleaseContacts(PATMEL_CONTEXT pDevice)
+{
+	bool any = false;
+
+	RtlZeroMemory(pDevice->EdgeContact, sizeof(pDevice->EdgeContact));
+	pDevice->ActiveMask = 0;
+	pDevice->ProbeMask = 0;
+
+	for (int i = 0; i < ATMEL_MAX_CONTACTS; i++) {
+		if (pDevice->Flags[i] != 0) {
+			pDevice->Flags[i] = MXT_T9_RELEASE;
+			any = true;
+		}
+	}
+
+	if (pDevice->PenSlot != ATMEL_PEN_NONE) {
+		AtmelReleasePen(pDevice);
+		AtmelProcessPen(pDevice);
+	}
+
+	if (!any)
+		return;
+
+	/* slots are forgotten once a read takes the lifts, the timer retries until then */
+	pDevice->ReportDirty = true;
+	AtmelProcessInput(pDevice);
+}
+
+/*
+* T6 reports the command processor status and the config checksum. After
+* a reset or a message FIFO overflow the touch stream has gaps, so the
+* contacts are released, the drain predictor restarted, and the cached
+* config revalidated at passive level when the checksum moved.
+*/
+static void
+AtmelHandleCommandStatus(PATMEL_CONTEXT pDevice, uint8_t *message)
+{
+	uint8_t status = message[1];
+	uint32_t crc = message[2] | (message[3] << 8) | (message[4] << 16);
+
+	if (status & (MXT_T6_STATUS_RESET | MXT_T6_STATUS_OFL)) {
+		if (status & MXT_T6_STATUS_RESET)
+			pDevice->t6_resets++;
+		else
+			pDevice->t6_overflows++;
+
+		pDevice->RecoveryStart = KeQueryPerformanceCounter(NULL);
+
+		AtmelReleaseContacts(pDevice);
+		InterlockedExchange(&pDevice->DrainReset, 1);
+
+		/*
+		* A reset reloads the stored config: the governor's T7 profile
+		* is gone and the cached T7 contents are stale.
+		*/
+		if (status & MXT_T6_STATUS_RESET) {
+			pDevice->PowerProfile = ATMEL_POWER_PROFILE_FACTORY;
+			pDevice->PowerProfileTarget = ATMEL_POWER_PROFILE_FACTORY;
+			InterlockedOr(&pDevice->PendingActions, ATMEL_ACTION_REVALIDATE_CONFIG);
+		}
+	}
+
+	if (status & MXT_T6_STATUS_CFGERR) {
+		pDevice->t6_config_errors++;
+		AtmelPrint(DEBUG_LEVEL_ERROR, DBG_PNP, "T6 reports config error, crc %06x\n", crc);
+	}
+
+	if (!pDevice->ConfigCrcValid) {
+		pDevice->config_crc = crc;
+		pDevice->ConfigCrcValid = true;
+	}
+	else if (crc != pDevice->config_crc) {
+		AtmelPrint(DEBUG_LEVEL_INFO, DBG_PNP, "Config crc changed %06x -> %06x\n", pDevice->config_crc, crc);
+		pDevice->config_crc = crc;
+
+		/* the revalidation times itself from here, with or without a reset */
+		if (!(status & MXT_T6_STATUS_RESET))
+			pDevice->RecoveryStart = KeQueryPerformanceCounter(NULL);
+		InterlockedOr(&pDevice->PendingActions, ATMEL_ACTION_REVALIDATE_CONFIG);
+	}
+}
+
+/*
+* One decoder is instantiated per (object type, resolution, T100 aux
+* layout) combination, so the per-message loop below carries no device
+* configuration branches; the IsT100 and Aux tests fold at compile time.
+*
+* T100 aux bytes follow the 16-bit positions in vect, ampl, area order,
+* each present only if enabled in TCHAUX.
+*/
+template <bool IsT100, int XShift, int YShift, ULONG Aux>
+static int
+AtmelDecodeMessages(PATMEL_CONTEXT pDevice, uint8_t *msg_buf, int count)
+{
+	const int vectOff = 6;
+	const int amplOff = 6 + ((Aux & MXT_T100_TCHAUX_VECT) ? 1 : 0);
+	const int areaOff = amplOff + ((Aux & MXT_T100_TCHAUX_AMPL) ? 1 : 0);
+
+	ATMEL_DECODE_BATCH *batch = &pDevice->DecodeBatch;
+	const uint8_t min_id = IsT100 ? pDevice->T100_reportid_min : pDevice->T9_reportid_min;
+	const uint8_t max_id = IsT100 ? pDevice->T100_reportid_max : pDevice->T9_reportid_max;
+	const int msg_size = pDevice->T5_msg_size;
+	int num_valid = 0;
+
+	batch->Count = 0;
+
+	for (int i = 0; i < count; i++) {
+		uint8_t *message = msg_buf + msg_size * i;
+		uint8_t report_id = message[0];
+		ULONG n;
+
+		if (report_id == 0xff)
+			continue;
+
+		num_valid++;
+
+		if (report_id < min_id || report_id > max_id) {
+			if (report_id == pDevice->T6_reportid) {
+				/* apply what came before the status in order */
+				AtmelFlushBatch<IsT100, XShift, YShift>(pDevice, batch);
+				AtmelHandleCommandStatus(pDevice, message);
+			}
+			continue;
+		}
+
+		n = batch->Count;
+
+		/* first two T100 report IDs reserved */
+		int slot = report_id - min_id - (IsT100 ? 2 : 0);
+		if ((unsigned)slot >= ATMEL_MAX_CONTACTS)
+			continue;
+
+		batch->Slot[n] = (uint8_t)slot;
+		batch->Flags[n] = message[1];
+
+		if (IsT100) {
+			batch->X[n] = (uint16_t)(message[2] | (message[3] << 8));
+			batch->Y[n] = (uint16_t)(message[4] | (message[5] << 8));
+			if (Aux & MXT_T100_TCHAUX_AREA) {
+				uint8_t vect = (Aux & MXT_T100_TCHAUX_VECT) ? message[vectOff] : 0;
+				ULONG side = pDevice->AreaSideLut[message[areaOff]];
+
+				batch->Width[n] = (uint16_t)((side * pDevice->VectMajorLut[vect]) >> 12);
+				batch->Height[n] = (uint16_t)((side * pDevice->VectMinorLut[vect]) >> 12);
+				batch->Azimuth[n] = pDevice->VectAzimuthLut[vect];
+			}
+			else {
+				batch->Width[n] = 10;
+				batch->Height[n] = 10;
+				batch->Azimuth[n] = 0;
+			}
+			/* without an amplitude byte every contact reads as full pressure */
+			batch->Ampl[n] = (Aux & MXT_T100_TCHAUX_AMPL) ? message[amplOff] : 0xff;
+		}
+		else {
+			batch->RawX[n] = message[2];
+			batch->RawY[n] = message[3];
+			batch->RawLo[n] = message[4];
+			batch->Width[n] = message[5];
+			batch->Height[n] = message[5];
+			batch->Azimuth[n] = 0;
+			batch->Ampl[n] = message[6];
+		}
+
+		if (++batch->Count == ATMEL_DECODE_BATCH_SIZE)
+			AtmelFlushBatch<IsT100, XShift, YShift>(pDevice, batch);
+	}
+
+	AtmelFlushBatch<IsT100, XShift, YShift>(pDevice, batch);
+
+	if (num_valid)
+		pDevice->RegsSet = true;
+
+	return num_valid;
+}
+
+int
+AtmelCountMessages(PATMEL_CONTEXT pDevice, uint8_t *msg_buf, int count)
+{
+	int num_valid = 0;
+
+	for (int i = 0; i < count; i++) {
+		if (msg_buf[pDevice->T5_msg_size * i] != 0xff)
+			num_valid++;
+	}
+
+	return num_valid;
+}
+
+VOID
+AtmelBuildPressureLut(PATMEL_CONTEXT pDevice)
+/*++
+
+Routine Description:
+
+Precomputes the amplitude to Tip Pressure curve. Amplitudes at or below
+PressureMin map to 0 and at or above PressureMax to MULTI_MAX_PRESSURE.
+In between the normalized amplitude x is bent toward x^2 by
+PressureCurve percent, so 0 is linear and 100 is softest at light touch.
+
+--*/
+{
+	ULONG lo = min(pDevice->PressureMin, 0xfe);
+	ULONG hi = min(max(pDevice->PressureMax, lo + 1), 0xff);
+	ULONG curve = min(pDevice->PressureCurve, 100);
+
+	for (ULONG i = 0; i < 256; i++) {
+		ULONG x;
+
+		if (i <= lo)
+			x = 0;
+		else if (i >= hi)
+			x = 1024;
+		else
+			x = ((i - lo) << 10) / (hi - lo);
+
+		/* x in Q10, blend with x^2 */
+		x = x - (curve * (x - ((x * x) >> 10))) / 100;
+
+		pDevice->PressureLut[i] = (USHORT)((x * MULTI_MAX_PRESSURE) >> 10);
+	}
+}
+
+VOID
+AtmelBuildSmoothingLut(PATMEL_CONTEXT pDevice)
+/*++
+
+Routine Description:
+
+Precomputes the smoothing weight for each contact speed. With the cutoff
+r = 256 * 2 pi fc Te growing linearly with speed from SmoothMinCutoff by
+SmoothBeta, the Q8 weight of a new sample is 256 * r / (256 + r).
+
+--*/
+{
+	for (ULONG s = 0; s < ATMEL_SMOOTH_SPEEDS; s++) {
+		ULONGLONG r = pDevice->SmoothMinCutoff + (ULONGLONG)pDevice->SmoothBeta * s;
+
+		pDevice->SmoothAlphaLut[s] = (USHORT)max((256 * r) / (256 + r), 1);
+	}
+}
+
+static ULONG
+AtmelIsqrt(ULONG v)
+{
+	ULONG root = 0;
+	ULONG bit = 1UL << 30;
+
+	while (bit > v)
+		bit >>= 2;
+
+	while (bit) {
+		if (v >= root + bit) {
+			v -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return root;
+}
+
+/* tan(0..45 degrees) in Q12 */
+static const USHORT AtmelTanQ12[46] = {
+	0, 71, 143, 215, 286, 358, 431, 503, 576, 649, 722, 796, 871, 946, 1021, 1098,
+	1175, 1252, 1331, 1410, 1491, 1572, 1655, 1739, 1824, 1910, 1998, 2087, 2178, 2270, 2365, 2461,
+	2559, 2660, 2763, 2868, 2976, 3087, 3200, 3317, 3437, 3561, 3688, 3820, 3955, 4096,
+};
+
+/* angle of (x, y) in whole degrees, 0..359 */
+static USHORT
+AtmelAtan2Deg(int y, int x)
+{
+	ULONG ax = x < 0 ? -x : x;
+	ULONG ay = y < 0 ? -y : y;
+	ULONG t;
+	int deg = 0;
+
+	if (ax == 0 && ay == 0)
+		return 0;
+
+	t = (min(ax, ay) << 12) / max(ax, ay);
+	while (deg < 45 && AtmelTanQ12[deg + 1] <= t)
+		deg++;
+
+	if (ay > ax)
+		deg = 90 - deg;
+	if (x < 0)
+		deg = 180 - deg;
+	if (y < 0)
+		deg = 360 - deg;
+
+	return (USHORT)(deg % 360);
+}
+
+static VOID
+AtmelBuildGeometryLut(PATMEL_CONTEXT pDevice)
+/*++
+
+Routine Description:
+
+Precomputes the T100 area and vector lookups so a contact's width,
+height and azimuth cost two multiplies per message.
+
+The area byte counts covered matrix nodes; one node spans the panel
+range divided by the matrix lines on each axis. The vector byte holds a
+signed 4-bit x (high nibble) and y (low nibble); its length elongates
+the contact to 1 + |v|/8 times as long as it is wide, keeping the area,
+and its direction gives the long axis orientation.
+
+The vector is taken through the coordinate transform, so this must run
+after AtmelSetupTransform. When the transform exchanges the axes, width
+and height are exchanged with them and the azimuth turns by 90 degrees
+to keep describing the same contact.
+
+--*/
+{
+	const LONG *m = pDevice->Transform;
+	ULONG nodes = pDevice->info.matrix_x_size * pDevice->info.matrix_y_size;
+	ULONG node_area = 0;
+
+	if (nodes)
+		node_area = ((ULONG)pDevice->max_x * pDevice->max_y) / nodes;
+
+	for (ULONG a = 0; a < 256; a++)
+		pDevice->AreaSideLut[a] = (USHORT)min(AtmelIsqrt(a * node_area), 0xffff);
+
+	for (ULONG v = 0; v < 256; v++) {
+		int vx = (int)(v >> 4) - ((v & 0x80) ? 16 : 0);
+		int vy = (int)(v & 0xf) - ((v & 0x8) ? 16 : 0);
+
+		/* |v| in Q8, elongation and its square root in Q12 */
+		ULONG len = AtmelIsqrt((ULONG)(vx * vx + vy * vy) << 16);
+		ULONG elong = 4096 + len * 2;
+		ULONG stretch = AtmelIsqrt(elong << 12);
+
+		/* the transform's linear part, kept small enough for the atan */
+		LONGLONG tx = (m[ATMEL_TRANSFORM_XX] * (LONGLONG)vx + m[ATMEL_TRANSFORM_XY] * (LONGLONG)vy) >> 8;
+		LONGLONG ty = (m[ATMEL_TRANSFORM_YX] * (LONGLONG)vx + m[ATMEL_TRANSFORM_YY] * (LONGLONG)vy) >> 8;
+
+		while (tx > 0x7fff || tx < -0x7fff || ty > 0x7fff || ty < -0x7fff) {
+			tx /= 2;
+			ty /= 2;
+		}
+
+		USHORT azimuth = AtmelAtan2Deg((int)ty, (int)tx);
+
+		if (pDevice->TransformSwap) {
+			pDevice->VectMajorLut[v] = (USHORT)((1UL << 24) / stretch);
+			pDevice->VectMinorLut[v] = (USHORT)stretch;
+			azimuth += 90;
+		}
+		else {
+			pDevice->VectMajorLut[v] = (USHORT)stretch;
+			pDevice->VectMinorLut[v] = (USHORT)((1UL << 24) / stretch);
+		}
+
+		/* an axis has no head or tail, fold into 0..179 */
+		pDevice->VectAzimuthLut[v] = azimuth % 180;
+	}
+}
+
+/* indexed by [x is 10-bit][y is 10-bit] */
+static const PATMEL_DECODE_ROUTINE AtmelT9Decoders[2][2] = {
+	{ AtmelDecodeMessages<false, 0, 0, 0>, AtmelDecodeMessages<false, 0, 2, 0> },
+	{ AtmelDecodeMessages<false, 2, 0, 0>, AtmelDecodeMessages<false, 2, 2, 0> },
+};
+
+/* indexed by the TCHAUX vect/ampl/area enable bits */
+static const PATMEL_DECODE_ROUTINE AtmelT100Decoders[8] = {
+	AtmelDecodeMessages<true, 0, 0, 0>,
+	AtmelDecodeMessages<true, 0, 0, 1>,
+	AtmelDecodeMessages<true, 0, 0, 2>,
+	AtmelDecodeMessages<true, 0, 0, 3>,
+	AtmelDecodeMessages<true, 0, 0, 4>,
+	AtmelDecodeMessages<true, 0, 0, 5>,
+	AtmelDecodeMessages<true, 0, 0, 6>,
+	AtmelDecodeMessages<true, 0, 0, 7>,
+};
+
+C_ASSERT(MXT_T100_TCHAUX_VECT == 1 && MXT_T100_TCHAUX_AMPL == 2 && MXT_T100_TCHAUX_AREA == 4);
+
+/*
+* Classify the registry transform and scale its offsets to the panel. A
+* transform that mostly exchanges the axes also exchanges the ranges, so
+* max_x and max_y describe the reported coordinates from here on.
+*/
+static VOID
+AtmelSetupTransform(PATMEL_CONTEXT pDevice)
+{
+	const LONG *m = pDevice->Transform;
+	const LONG one = ATMEL_TRANSFORM_ONE;
+	bool orthogonal = false;
+	bool swap;
+
+	if (m[ATMEL_TRANSFORM_XY] == 0 && m[ATMEL_TRANSFORM_YX] == 0 &&
+		(m[ATMEL_TRANSFORM_XX] == one || m[ATMEL_TRANSFORM_XX] == -one) &&
+		(m[ATMEL_TRANSFORM_YY] == one || m[ATMEL_TRANSFORM_YY] == -one)) {
+		orthogonal = true;
+		pDevice->TransformFlipX = m[ATMEL_TRANSFORM_XX] < 0;
+		pDevice->TransformFlipY = m[ATMEL_TRANSFORM_YY] < 0;
+	}
+	else if (m[ATMEL_TRANSFORM_XX] == 0 && m[ATMEL_TRANSFORM_YY] == 0 &&
+		(m[ATMEL_TRANSFORM_XY] == one || m[ATMEL_TRANSFORM_XY] == -one) &&
+		(m[ATMEL_TRANSFORM_YX] == one || m[ATMEL_TRANSFORM_YX] == -one)) {
+		orthogonal = true;
+		pDevice->TransformFlipX = m[ATMEL_TRANSFORM_XY] < 0;
+		pDevice->TransformFlipY = m[ATMEL_TRANSFORM_YX] < 0;
+	}
+
+	/* a flip only stays on the panel with the matching full range offset */
+	if (orthogonal &&
+		(m[ATMEL_TRANSFORM_X0] != (pDevice->TransformFlipX ? one : 0) ||
+		m[ATMEL_TRANSFORM_Y0] != (pDevice->TransformFlipY ? one : 0)))
+		orthogonal = false;
+
+	LONGLONG xx = m[ATMEL_TRANSFORM_XX];
+	LONGLONG xy = m[ATMEL_TRANSFORM_XY];
+
+	swap = (xy < 0 ? -xy : xy) > (xx < 0 ? -xx : xx);
+	pDevice->TransformSwap = swap;
+
+	if (swap) {
+		uint16_t t = pDevice->max_x;
+		pDevice->max_x = pDevice->max_y;
+		pDevice->max_y = t;
+	}
+
+	pDevice->TransformXOffset = (LONGLONG)m[ATMEL_TRANSFORM_X0] * (pDevice->max_x - 1);
+	pDevice->TransformYOffset = (LONGLONG)m[ATMEL_TRANSFORM_Y0] * (pDevice->max_y - 1);
+
+	if (!orthogonal)
+		pDevice->TransformKind = ATMEL_TRANSFORM_AFFINE;
+	else if (swap || pDevice->TransformFlipX || pDevice->TransformFlipY)
+		pDevice->TransformKind = ATMEL_TRANSFORM_ORTHOGONAL;
+	else
+		pDevice->TransformKind = ATMEL_TRANSFORM_IDENTITY;
+}
+
+VOID
+AtmelSelectDecoder(PATMEL_CONTEXT pDevice)
+/*++
+
+Routine Description:
+
+Picks the decode routine matching the booted configuration, sets up the
+coordinate transform and scales the edge bands and jitter hysteresis to
+the panel. Must
+be called once the object type, resolution and T100 aux layout are
+known, and only once per resolution read.
+
+--*/
+{
+	if (pDevice->multitouch == MXT_TOUCH_MULTI_T9) {
+		pDevice->DecodeMessages = AtmelT9Decoders
+			[pDevice->max_x < 1024 ? 1 : 0]
+			[pDevice->max_y < 1024 ? 1 : 0];
+	}
+	else if (pDevice->multitouch == MXT_TOUCH_MULTITOUCHSCREEN_T100) {
+		ULONG aux = 0;
+
+		if (pDevice->t100_aux_vect)
+			aux |= MXT_T100_TCHAUX_VECT;
+		if (pDevice->t100_aux_ampl)
+			aux |= MXT_T100_TCHAUX_AMPL;
+		if (pDevice->t100_aux_area)
+			aux |= MXT_T100_TCHAUX_AREA;
+
+		pDevice->DecodeMessages = AtmelT100Decoders[aux];
+	}
+	else {
+		pDevice->DecodeMessages = AtmelCountMessages;
+	}
+
+	AtmelSetupTransform(pDevice);
+
+	/* contact geometry follows the transform */
+	if (pDevice->multitouch == MXT_TOUCH_MULTITOUCHSCREEN_T100)
+		AtmelBuildGeometryLut(pDevice);
+
+	/* edge bands on the reported ranges */
+	pDevice->EdgeMinX = (USHORT)min((ULONG)pDevice->max_x * pDevice->EdgeBand / 1000, 0xffff);
+	pDevice->EdgeMinY = (USHORT)min((ULONG)pDevice->max_y * pDevice->EdgeBand / 1000, 0xffff);
+	pDevice->EdgeMaxX = (USHORT)max((LONG)pDevice->max_x - 1 - pDevice->EdgeMinX, 0);
+	pDevice->EdgeMaxY = (USHORT)max((LONG)pDevice->max_y - 1 - pDevice->EdgeMinY, 0);
+
+	pDevice->FuzzX = (USHORT)min((ULONG)pDevice->max_x * pDevice->Hysteresis / 1000, 0xffff);
+	pDevice->FuzzY = (USHORT)min((ULONG)pDevice->max_y * pDevice->Hysteresis / 1000, 0xffff);
+}
+
+/*
+* In message CRC mode the last byte of each message is a CRC8 over the
+* rest. Failed messages are invalidated in place so the decoder skips
+* them like an empty slot. msg_buf holds only messages read from T5
+* with the CRC flag; the T44 count byte in front of it is never checked.
+*/
+static void
+AtmelVerifyMessages(PATMEL_CONTEXT pDevice, uint8_t *msg_buf, int count)
+{
+	const int payload = pDevice->T5_msg_size - 1;
+
+	for (int i = 0; i < count; i++) {
+		uint8_t *message = msg_buf + pDevice->T5_msg_size * i;
+
+		if (message[0] == 0xff)
+			continue;
+
+		if (obp_crc8(message, payload) != message[payload]) {
+			pDevice->crc_errors++;
+			message[0] = 0xff;
+		}
+	}
+}
+
+int
+AtmelProcessMessages(PATMEL_CONTEXT pDevice, uint8_t *msg_buf, int count)
+/*++
+
+Routine Description:
+
+Decodes a buffer of count T5 messages, updating the contact state.
+Reports are not emitted here; the caller reports once per drain.
+Messages drained before a decoder is selected are only counted, and in
+message CRC mode messages failing their checksum are dropped.
+
+Return Value:
+
+The number of valid (non 0xff) messages in the buffer
+
+--*/
+{
+	if (pDevice->MessageCrc)
+		AtmelVerifyMessages(pDevice, msg_buf, count);
+
+	if (pDevice->DecodeMessages == NULL)
+		return AtmelCountMessages(pDevice, msg_buf, count);
+
+	return pDevice->DecodeMessages(pDevice, msg_buf, count);
+}
@@ -16,6 +16,7 @@
 
 #define REPORTID_MTOUCH         0x01
 #define REPORTID_FEATURE        0x02
+#define REPORTID_PEN            0x03
 
 //
 // Multitouch specific report information
@@ -29,6 +30,11 @@
 
 #define MULTI_MAX_COUNT        10
 
+#define MULTI_MAX_PRESSURE     1023
+
+/* contact azimuth is an axis, folded into 0..179 by the decoder */
+#define MULTI_MAX_AZIMUTH      179
+
 #pragma pack(1)
 typedef struct
 {
@@ -45,6 +51,10 @@ typedef struct
 
 	USHORT    Height;
 
+	USHORT    Pressure;
+
+	USHORT    Azimuth;
+
 }
 TOUCH, *PTOUCH;
 
@@ -60,6 +70,30 @@ typedef struct _ATMEL_MULTITOUCH_REPORT
 } AtmelMultiTouchReport;
 #pragma pack()
 
+//
+// Pen specific report information
+//
+
+#define PEN_TIPSWITCH_BIT      1
+#define PEN_INRANGE_BIT        2
+
+#pragma pack(1)
+typedef struct _ATMEL_PEN_REPORT
+{
+
+	BYTE      ReportID;
+
+	BYTE      Status;
+
+	USHORT    XValue;
+
+	USHORT    YValue;
+
+	USHORT    Pressure;
+
+} AtmelPenReport;
+#pragma pack()
+
 //
 // Feature report infomation
 //
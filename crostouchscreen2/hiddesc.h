@@ -0,0 +1,244 @@
+#if !defined(_ATMEL_HIDDESC_H_)
+#define _ATMEL_HIDDESC_H_
+
+//
+// Compile-time report descriptor builder.
+//
+// The touch and pen collections are generated by constexpr functions
+// instead of being spelled out byte by byte. While emitting items the
+// builder tracks the Report Size and Report Count globals, so the bits
+// each collection declares can be checked against the report structures
+// in hidcommon.h with static_assert. The panel's logical maxima are only
+// known after boot; the builder records where they live so they can be
+// patched in place.
+//
+
+#define ATMEL_MAX_REPORT_DESCRIPTOR 1024
+
+//
+// Optional per-contact fields
+//
+
+#define ATMEL_TOUCH_FIELD_WIDTH     0x01
+#define ATMEL_TOUCH_FIELD_HEIGHT    0x02
+#define ATMEL_TOUCH_FIELD_PRESSURE  0x04
+#define ATMEL_TOUCH_FIELD_AZIMUTH   0x08
+
+#define ATMEL_TOUCH_FIELDS (ATMEL_TOUCH_FIELD_WIDTH | ATMEL_TOUCH_FIELD_HEIGHT | \
+	ATMEL_TOUCH_FIELD_PRESSURE | ATMEL_TOUCH_FIELD_AZIMUTH)
+
+//
+// Short item prefixes, size bits clear
+//
+
+#define HID_ITEM_INPUT              0x80
+#define HID_ITEM_FEATURE            0xb0
+#define HID_ITEM_COLLECTION         0xa0
+#define HID_ITEM_END_COLLECTION     0xc0
+#define HID_ITEM_USAGE_PAGE         0x04
+#define HID_ITEM_LOGICAL_MINIMUM    0x14
+#define HID_ITEM_LOGICAL_MAXIMUM    0x24
+#define HID_ITEM_PHYSICAL_MINIMUM   0x34
+#define HID_ITEM_PHYSICAL_MAXIMUM   0x44
+#define HID_ITEM_UNIT_EXPONENT      0x54
+#define HID_ITEM_UNIT               0x64
+#define HID_ITEM_REPORT_SIZE        0x74
+#define HID_ITEM_REPORT_ID          0x84
+#define HID_ITEM_REPORT_COUNT       0x94
+#define HID_ITEM_USAGE              0x08
+
+#define HID_DATA_VAR_ABS            0x02
+#define HID_CNST_VAR_ABS            0x03
+
+typedef struct _ATMEL_HID_LAYOUT
+{
+	UCHAR Bytes[ATMEL_MAX_REPORT_DESCRIPTOR];
+	USHORT Length;
+
+	/* input bits declared after the report id */
+	ULONG InputBits;
+
+	/* offsets of the 16-bit X and Y logical maxima, one pair per collection */
+	USHORT XMaxOffset[MULTI_MAX_COUNT];
+	USHORT YMaxOffset[MULTI_MAX_COUNT];
+	USHORT PatchCount;
+
+	/* current global state */
+	ULONG ReportSize;
+	ULONG ReportCount;
+} ATMEL_HID_LAYOUT;
+
+constexpr void
+HidItem(
+	ATMEL_HID_LAYOUT &Layout,
+	UCHAR Prefix,
+	ULONG Value,
+	int Size
+)
+{
+	Layout.Bytes[Layout.Length++] = (UCHAR)(Prefix | (Size == 4 ? 3 : Size));
+	for (int i = 0; i < Size; i++)
+		Layout.Bytes[Layout.Length++] = (UCHAR)(Value >> (8 * i));
+
+	if (Prefix == HID_ITEM_REPORT_SIZE)
+		Layout.ReportSize = Value;
+	else if (Prefix == HID_ITEM_REPORT_COUNT)
+		Layout.ReportCount = Value;
+	else if (Prefix == HID_ITEM_INPUT)
+		Layout.InputBits += Layout.ReportSize * Layout.ReportCount;
+}
+
+constexpr void
+HidCoordinateItem(
+	ATMEL_HID_LAYOUT &Layout,
+	UCHAR Usage,
+	USHORT &Offset
+)
+{
+	/* LOGICAL_MAXIMUM is patched with the panel resolution at boot */
+	Offset = Layout.Length + 1;
+	HidItem(Layout, HID_ITEM_LOGICAL_MAXIMUM, 0, 2);
+	HidItem(Layout, HID_ITEM_USAGE, Usage, 1);
+	HidItem(Layout, HID_ITEM_INPUT, HID_DATA_VAR_ABS, 1);
+}
+
+constexpr ATMEL_HID_LAYOUT
+AtmelBuildTouchLayout(
+	int Contacts,
+	ULONG Fields
+)
+{
+	ATMEL_HID_LAYOUT l = {};
+
+	HidItem(l, HID_ITEM_USAGE_PAGE, 0x0d, 1);           // Digitizers
+	HidItem(l, HID_ITEM_USAGE, 0x04, 1);                // Touch Screen
+	HidItem(l, HID_ITEM_COLLECTION, 0x01, 1);           // Application
+	HidItem(l, HID_ITEM_REPORT_ID, REPORTID_MTOUCH, 1);
+	HidItem(l, HID_ITEM_USAGE, 0x22, 1);                // Finger
+
+	for (int i = 0; i < Contacts; i++) {
+		HidItem(l, HID_ITEM_COLLECTION, 0x02, 1);       // Logical
+		HidItem(l, HID_ITEM_USAGE, 0x42, 1);            // Tip Switch
+		HidItem(l, HID_ITEM_LOGICAL_MINIMUM, 0, 1);
+		HidItem(l, HID_ITEM_LOGICAL_MAXIMUM, 1, 1);
+		HidItem(l, HID_ITEM_REPORT_SIZE, 1, 1);
+		HidItem(l, HID_ITEM_REPORT_COUNT, 1, 1);
+		HidItem(l, HID_ITEM_INPUT, HID_DATA_VAR_ABS, 1);
+		HidItem(l, HID_ITEM_USAGE, 0x47, 1);            // Confidence
+		HidItem(l, HID_ITEM_INPUT, HID_DATA_VAR_ABS, 1);
+		HidItem(l, HID_ITEM_REPORT_COUNT, 6, 1);
+		HidItem(l, HID_ITEM_INPUT, HID_CNST_VAR_ABS, 1);
+		HidItem(l, HID_ITEM_REPORT_SIZE, 8, 1);
+		HidItem(l, HID_ITEM_USAGE, 0x51, 1);            // Contact Identifier
+		HidItem(l, HID_ITEM_REPORT_COUNT, 1, 1);
+		HidItem(l, HID_ITEM_INPUT, HID_DATA_VAR_ABS, 1);
+		HidItem(l, HID_ITEM_USAGE_PAGE, 0x01, 1);       // Generic Desktop
+		HidItem(l, HID_ITEM_REPORT_SIZE, 16, 1);
+		HidItem(l, HID_ITEM_UNIT_EXPONENT, 0, 1);
+		HidItem(l, HID_ITEM_UNIT, 0, 1);
+		HidItem(l, HID_ITEM_PHYSICAL_MINIMUM, 0, 1);
+		HidItem(l, HID_ITEM_PHYSICAL_MAXIMUM, 0, 2);
+
+		HidCoordinateItem(l, 0x30, l.XMaxOffset[l.PatchCount]);     // X
+		HidCoordinateItem(l, 0x31, l.YMaxOffset[l.PatchCount]);     // Y
+		l.PatchCount++;
+
+		HidItem(l, HID_ITEM_USAGE_PAGE, 0x0d, 1);       // Digitizers
+
+		/* Width and Height share the Y logical maximum */
+		if (Fields & ATMEL_TOUCH_FIELD_WIDTH) {
+			HidItem(l, HID_ITEM_USAGE, 0x48, 1);
+			HidItem(l, HID_ITEM_INPUT, HID_DATA_VAR_ABS, 1);
+		}
+		if (Fields & ATMEL_TOUCH_FIELD_HEIGHT) {
+			HidItem(l, HID_ITEM_USAGE, 0x49, 1);
+			HidItem(l, HID_ITEM_INPUT, HID_DATA_VAR_ABS, 1);
+		}
+		if (Fields & ATMEL_TOUCH_FIELD_PRESSURE) {
+			HidItem(l, HID_ITEM_USAGE, 0x30, 1);        // Tip Pressure
+			HidItem(l, HID_ITEM_LOGICAL_MAXIMUM, MULTI_MAX_PRESSURE, 2);
+			HidItem(l, HID_ITEM_INPUT, HID_DATA_VAR_ABS, 1);
+		}
+		if (Fields & ATMEL_TOUCH_FIELD_AZIMUTH) {
+			HidItem(l, HID_ITEM_USAGE, 0x3f, 1);
+			HidItem(l, HID_ITEM_LOGICAL_MAXIMUM, MULTI_MAX_AZIMUTH, 2);
+			HidItem(l, HID_ITEM_INPUT, HID_DATA_VAR_ABS, 1);
+		}
+
+		HidItem(l, HID_ITEM_END_COLLECTION, 0, 0);
+	}
+
+	HidItem(l, HID_ITEM_USAGE_PAGE, 0x0d, 1);           // Digitizers
+	HidItem(l, HID_ITEM_USAGE, 0x54, 1);                // Contact Count
+	HidItem(l, HID_ITEM_REPORT_COUNT, 1, 1);
+	HidItem(l, HID_ITEM_REPORT_SIZE, 8, 1);
+	HidItem(l, HID_ITEM_LOGICAL_MINIMUM, 0, 1);
+	HidItem(l, HID_ITEM_LOGICAL_MAXIMUM, 8, 1);
+	HidItem(l, HID_ITEM_INPUT, HID_DATA_VAR_ABS, 1);
+	HidItem(l, HID_ITEM_USAGE, 0x55, 1);                // Contact Count Maximum
+	HidItem(l, HID_ITEM_FEATURE, HID_DATA_VAR_ABS, 1);
+	HidItem(l, HID_ITEM_END_COLLECTION, 0, 0);
+
+	return l;
+}
+
+constexpr ATMEL_HID_LAYOUT
+AtmelBuildPenLayout()
+{
+	ATMEL_HID_LAYOUT l = {};
+
+	HidItem(l, HID_ITEM_USAGE_PAGE, 0x0d, 1);           // Digitizers
+	HidItem(l, HID_ITEM_USAGE, 0x02, 1);                // Pen
+	HidItem(l, HID_ITEM_COLLECTION, 0x01, 1);           // Application
+	HidItem(l, HID_ITEM_REPORT_ID, REPORTID_PEN, 1);
+	HidItem(l, HID_ITEM_USAGE, 0x20, 1);                // Stylus
+	HidItem(l, HID_ITEM_COLLECTION, 0x00, 1);           // Physical
+	HidItem(l, HID_ITEM_USAGE, 0x42, 1);                // Tip Switch
+	HidItem(l, HID_ITEM_USAGE, 0x32, 1);                // In Range
+	HidItem(l, HID_ITEM_LOGICAL_MINIMUM, 0, 1);
+	HidItem(l, HID_ITEM_LOGICAL_MAXIMUM, 1, 1);
+	HidItem(l, HID_ITEM_REPORT_SIZE, 1, 1);
+	HidItem(l, HID_ITEM_REPORT_COUNT, 2, 1);
+	HidItem(l, HID_ITEM_INPUT, HID_DATA_VAR_ABS, 1);
+	HidItem(l, HID_ITEM_REPORT_COUNT, 6, 1);
+	HidItem(l, HID_ITEM_INPUT, HID_CNST_VAR_ABS, 1);
+	HidItem(l, HID_ITEM_USAGE_PAGE, 0x01, 1);           // Generic Desktop
+	HidItem(l, HID_ITEM_REPORT_SIZE, 16, 1);
+	HidItem(l, HID_ITEM_REPORT_COUNT, 1, 1);
+	HidItem(l, HID_ITEM_UNIT_EXPONENT, 0, 1);
+	HidItem(l, HID_ITEM_UNIT, 0, 1);
+	HidItem(l, HID_ITEM_PHYSICAL_MINIMUM, 0, 1);
+	HidItem(l, HID_ITEM_PHYSICAL_MAXIMUM, 0, 2);
+
+	HidCoordinateItem(l, 0x30, l.XMaxOffset[0]);        // X
+	HidCoordinateItem(l, 0x31, l.YMaxOffset[0]);        // Y
+	l.PatchCount = 1;
+
+	HidItem(l, HID_ITEM_USAGE_PAGE, 0x0d, 1);           // Digitizers
+	HidItem(l, HID_ITEM_USAGE, 0x30, 1);                // Tip Pressure
+	HidItem(l, HID_ITEM_LOGICAL_MAXIMUM, MULTI_MAX_PRESSURE, 2);
+	HidItem(l, HID_ITEM_INPUT, HID_DATA_VAR_ABS, 1);
+	HidItem(l, HID_ITEM_END_COLLECTION, 0, 0);
+	HidItem(l, HID_ITEM_END_COLLECTION, 0, 0);
+
+	return l;
+}
+
+static constexpr ATMEL_HID_LAYOUT AtmelTouchLayout =
+	AtmelBuildTouchLayout(MULTI_MAX_COUNT, ATMEL_TOUCH_FIELDS);
+
+static constexpr ATMEL_HID_LAYOUT AtmelPenLayout = AtmelBuildPenLayout();
+
+//
+// The declared input bits, plus the report id byte, must match the
+// structures the driver fills in.
+//
+
+static_assert(8 + AtmelTouchLayout.InputBits == 8 * sizeof(AtmelMultiTouchReport),
+	"touch report descriptor does not match AtmelMultiTouchReport");
+static_assert(8 + AtmelPenLayout.InputBits == 8 * sizeof(AtmelPenReport),
+	"pen report descriptor does not match AtmelPenReport");
+static_assert(AtmelTouchLayout.Length + AtmelPenLayout.Length <= ATMEL_MAX_REPORT_DESCRIPTOR,
+	"report descriptor does not fit ATMEL_MAX_REPORT_DESCRIPTOR");
+
+#endif
@@ -255,6 +255,309 @@ exit:
 	return status;
 }
 
+static VOID
+SpbRetryBackoff(
+	IN ULONG Attempt
+	)
+	/*++
+
+	Routine Description:
+
+	Waits before retrying a failed transfer. The first few retries
+	spin for a few microseconds since a controller waking from deep
+	sleep usually ACKs again almost immediately; later retries sleep
+	so a genuinely wedged bus does not burn the CPU.
+
+	Arguments:
+
+	Attempt    - The number of the retry about to be issued, starting at 1
+
+	Return Value:
+
+	None
+
+	--*/
+{
+	LARGE_INTEGER delay;
+
+	if (Attempt <= SPB_RETRY_SPIN_ATTEMPTS)
+	{
+		KeStallExecutionProcessor(SPB_RETRY_SPIN_US);
+	}
+	else
+	{
+		delay.QuadPart = WDF_REL_TIMEOUT_IN_MS(SPB_RETRY_SLEEP_MS);
+		KeDelayExecutionThread(KernelMode, FALSE, &delay);
+	}
+}
+
+NTSTATUS
+SpbDoReadDataSynchronously16(
+	_In_ SPB_CONTEXT *SpbContext,
+	_In_ UINT16 Address,
+	_In_reads_bytes_(Length) PVOID Data,
+	_In_ ULONG Length
+	);
+
+static NTSTATUS
+SpbDoTransferWithRetry(
+	IN SPB_CONTEXT *SpbContext,
+	IN BOOLEAN Read,
+	IN UINT16 Address,
+	IN PVOID Data,
+	IN ULONG Length
+	)
+	/*++
+
+	Routine Description:
+
+	Issues a single read or write with the SPB lock held, retrying
+	failed transfers up to the context's retry budget since maXTouch
+	parts NAK the first transaction after deep sleep.
+
+	Arguments:
+
+	SpbContext - Pointer to the current device context
+	Read       - TRUE for a read, FALSE for a write
+	Address    - The I2C register address to transfer at
+	Data       - The buffer to read into or write from
+	Length     - The amount of data to transfer
+
+	Return Value:
+
+	NTSTATUS Status indicating success or failure
+
+	--*/
+{
+	NTSTATUS status;
+	ULONG attempt;
+
+	attempt = 0;
+	do
+	{
+		if (attempt > 0)
+		{
+			SpbRetryBackoff(attempt);
+		}
+
+		if (Read)
+		{
+			status = SpbDoReadDataSynchronously16(
+				SpbContext,
+				Address,
+				Data,
+				Length);
+		}
+		else
+		{
+			status = SpbDoWriteDataSynchronously16(
+				SpbContext,
+				Address,
+				Data,
+				Length);
+		}
+
+		attempt++;
+	} while (!NT_SUCCESS(status) &&
+		status != STATUS_INSUFFICIENT_RESOURCES &&
+		attempt < SpbContext->RetryBudget);
+
+	if (attempt > 1)
+	{
+		InterlockedExchangeAdd(&SpbContext->RetryCount, (LONG)(attempt - 1));
+
+		if (NT_SUCCESS(status))
+		{
+			InterlockedIncrement(&SpbContext->RetryRecovered);
+		}
+		else
+		{
+			InterlockedIncrement(&SpbContext->RetryExhausted);
+		}
+	}
+
+	return status;
+}
+
+static VOID
+SpbAcquireBus(
+	IN SPB_CONTEXT *SpbContext,
+	IN SPB_PRIORITY Priority
+	)
+	/*++
+
+	Routine Description:
+
+	Acquires the SPB lock. Message drains announce themselves before
+	waiting so that background transfers step aside for them: a
+	background caller that finds a drain waiting, or that wins the lock
+	while one is queued, yields and tries again. Background callers give
+	up deferring after SPB_BACKGROUND_MAX_DEFERRALS so they cannot be
+	starved indefinitely by a busy panel.
+
+	Arguments:
+
+	SpbContext - Pointer to the current device context
+	Priority   - Priority of the transfer about to be issued
+
+	Return Value:
+
+	None
+
+	--*/
+{
+	LARGE_INTEGER yield;
+	ULONG deferrals;
+
+	if (Priority == SpbPriorityMessage)
+	{
+		InterlockedIncrement(&SpbContext->MessageWaiters);
+		WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
+		InterlockedDecrement(&SpbContext->MessageWaiters);
+		return;
+	}
+
+	yield.QuadPart = 0;
+
+	for (deferrals = 0; ; deferrals++)
+	{
+		if (deferrals < SPB_BACKGROUND_MAX_DEFERRALS &&
+			SpbContext->MessageWaiters > 0)
+		{
+			KeDelayExecutionThread(KernelMode, FALSE, &yield);
+			continue;
+		}
+
+		WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
+
+		if (deferrals >= SPB_BACKGROUND_MAX_DEFERRALS ||
+			SpbContext->MessageWaiters == 0)
+		{
+			return;
+		}
+
+		WdfWaitLockRelease(SpbContext->SpbLock);
+	}
+}
+
+static VOID
+SpbReleaseBus(
+	IN SPB_CONTEXT *SpbContext
+	)
+{
+	WdfWaitLockRelease(SpbContext->SpbLock);
+}
+
+static NTSTATUS
+SpbDoChunkedTransfer(
+	IN SPB_CONTEXT *SpbContext,
+	IN BOOLEAN Read,
+	IN UINT16 Address,
+	IN PVOID Data,
+	IN ULONG Length,
+	IN SPB_PRIORITY Priority
+	)
+	/*++
+
+	Routine Description:
+
+	Splits a register transfer into pieces no larger than both the
+	background chunk size and the controller's maximum transfer size,
+	advancing the register address with each piece. The pieces are
+	issued back to back under one hold of the bus; a background
+	transfer only gives the bus up between pieces when a message drain
+	is waiting for it.
+
+	Message reads are never split here: T5 has to be re-read from the
+	same address rather than at an offset, so drain callers size their
+	reads to the controller limit themselves. A message read that does
+	not fit fails rather than exceeding the limit.
+
+	Arguments:
+
+	SpbContext - Pointer to the current device context
+	Read       - TRUE for a read, FALSE for a write
+	Address    - The I2C register address to start at
+	Data       - The buffer to read into or write from
+	Length     - The amount of data to transfer
+	Priority   - Priority of the transfer
+
+	Return Value:
+
+	NTSTATUS Status indicating success or failure
+
+	--*/
+{
+	NTSTATUS status;
+	ULONG maxChunk;
+	ULONG offset;
+	ULONG chunk;
+
+	if (Priority == SpbPriorityMessage)
+	{
+		if (SpbContext->MaxTransferSize != 0 &&
+			Length > SpbContext->MaxTransferSize)
+		{
+			AtmelPrint(
+				DEBUG_LEVEL_ERROR,
+				DBG_IOCTL,
+				"Message read of %d bytes exceeds the transfer limit of %d",
+				Length,
+				SpbContext->MaxTransferSize);
+			return STATUS_INVALID_BUFFER_SIZE;
+		}
+
+		maxChunk = Length;
+	}
+	else
+	{
+		maxChunk = SPB_BACKGROUND_CHUNK_SIZE;
+
+		if (SpbContext->MaxTransferSize != 0)
+		{
+			//
+			// Writes carry the two address bytes in the same transfer
+			//
+			chunk = Read ? SpbContext->MaxTransferSize :
+				SpbContext->MaxTransferSize - sizeof(UINT16);
+			maxChunk = min(maxChunk, chunk);
+		}
+	}
+
+	status = STATUS_SUCCESS;
+
+	SpbAcquireBus(SpbContext, Priority);
+
+	for (offset = 0; offset < Length; offset += chunk)
+	{
+		chunk = min(Length - offset, maxChunk);
+
+		if (offset > 0 &&
+			Priority == SpbPriorityBackground &&
+			SpbContext->MessageWaiters > 0)
+		{
+			SpbReleaseBus(SpbContext);
+			SpbAcquireBus(SpbContext, Priority);
+		}
+
+		status = SpbDoTransferWithRetry(
+			SpbContext,
+			Read,
+			(UINT16)(Address + offset),
+			(PUCHAR)Data + offset,
+			chunk);
+
+		if (!NT_SUCCESS(status))
+		{
+			break;
+		}
+	}
+
+	SpbReleaseBus(SpbContext);
+
+	return status;
+}
+
 NTSTATUS
 SpbWriteDataSynchronously(
 IN SPB_CONTEXT *SpbContext,
@@ -326,19 +629,17 @@ SpbWriteDataSynchronously16(
 
 	--*/
 {
-	NTSTATUS status;
-
-	WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
-
-	status = SpbDoWriteDataSynchronously16(
+	//
+	// Config writes are background work; long ones are split so that a
+	// message drain never waits behind more than one chunk
+	//
+	return SpbDoChunkedTransfer(
 		SpbContext,
+		FALSE,
 		Address,
 		Data,
-		Length);
-
-	WdfWaitLockRelease(SpbContext->SpbLock);
-
-	return status;
+		Length,
+		SpbPriorityBackground);
 }
 
 NTSTATUS
@@ -471,7 +772,7 @@ exit:
 }
 
 NTSTATUS
-SpbReadDataSynchronously16(
+SpbDoReadDataSynchronously16(
 	_In_ SPB_CONTEXT *SpbContext,
 	_In_ UINT16 Address,
 	_In_reads_bytes_(Length) PVOID Data,
@@ -503,8 +804,6 @@ SpbReadDataSynchronously16(
 	NTSTATUS status;
 	ULONG_PTR bytesRead;
 
-	WdfWaitLockAcquire(SpbContext->SpbLock, NULL);
-
 	memory = NULL;
 	status = STATUS_INVALID_PARAMETER;
 	bytesRead = 0;
@@ -572,8 +871,16 @@ SpbReadDataSynchronously16(
 		NULL,
 		&bytesRead);
 
-	if (!NT_SUCCESS(status) ||
+	if (NT_SUCCESS(status) &&
 		bytesRead != Length)
+	{
+		//
+		// A short read means the target stopped ACKing mid-transfer
+		//
+		status = STATUS_DEVICE_PROTOCOL_ERROR;
+	}
+
+	if (!NT_SUCCESS(status))
 	{
 		AtmelPrint(
 			DEBUG_LEVEL_ERROR,
@@ -594,11 +901,54 @@ exit:
 		WdfObjectDelete(memory);
 	}
 
-	WdfWaitLockRelease(SpbContext->SpbLock);
-
 	return status;
 }
 
+NTSTATUS
+SpbReadDataSynchronously16(
+	_In_ SPB_CONTEXT *SpbContext,
+	_In_ UINT16 Address,
+	_In_reads_bytes_(Length) PVOID Data,
+	_In_ ULONG Length,
+	_In_ SPB_PRIORITY Priority
+	)
+	/*++
+
+	Routine Description:
+
+	This routine abstracts creating and sending an I/O
+	request (I2C Read) to the Spb I/O target and utilizes
+	a helper routine to do work inside of locked code.
+
+	Message reads take the bus ahead of background transfers and are
+	issued in one piece. Background reads are split into chunks no
+	larger than the controller's maximum transfer size, and give up the
+	bus between chunks when a drain is waiting.
+
+	Arguments:
+
+	SpbContext - Pointer to the current device context
+	Address    - The I2C register address to read from
+	Data       - A buffer to receive the data at at the above address
+	Length     - The amount of data to be read from the above address
+	Priority   - SpbPriorityMessage for message drains, otherwise
+	             SpbPriorityBackground
+
+	Return Value:
+
+	NTSTATUS Status indicating success or failure
+
+	--*/
+{
+	return SpbDoChunkedTransfer(
+		SpbContext,
+		TRUE,
+		Address,
+		Data,
+		Length,
+		Priority);
+}
+
 VOID
 SpbTargetDeinitialize(
 IN WDFDEVICE FxDevice,
@@ -736,6 +1086,18 @@ NTSTATUS Status indicating success or failure
 		goto exit;
 	}
 
+	SpbContext->RetryBudget = SPB_RETRY_MAX_ATTEMPTS;
+	SpbContext->RetryCount = 0;
+	SpbContext->RetryRecovered = 0;
+	SpbContext->RetryExhausted = 0;
+	SpbContext->MessageWaiters = 0;
+
+	if (SpbContext->MaxTransferSize != 0 &&
+		SpbContext->MaxTransferSize < SPB_MIN_TRANSFER_SIZE)
+	{
+		SpbContext->MaxTransferSize = SPB_MIN_TRANSFER_SIZE;
+	}
+
 	//
 	// Allocate some fixed-size buffers from NonPagedPool for typical
 	// Spb transaction sizes to avoid pool fragmentation in most cases
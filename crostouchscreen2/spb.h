@@ -26,6 +26,39 @@ Revision History:
 #define DEFAULT_SPB_BUFFER_SIZE 64
 #define RESHUB_USE_HELPER_ROUTINES
 
+//
+// Retry policy for transfers the target NAKs (e.g. right after deep sleep).
+// The budget counts total attempts per operation; the first retries spin,
+// the rest sleep, so the worst case stays around a couple of milliseconds.
+//
+
+#define SPB_RETRY_MAX_ATTEMPTS  4
+#define SPB_RETRY_SPIN_ATTEMPTS 2
+#define SPB_RETRY_SPIN_US       50
+#define SPB_RETRY_SLEEP_MS      2
+
+//
+// Bus arbitration. Message drains run ahead of background (config and
+// diagnostic) transfers, which are split into chunks that give up the
+// bus in between.
+//
+
+#define SPB_BACKGROUND_CHUNK_SIZE     32
+#define SPB_BACKGROUND_MAX_DEFERRALS  16
+
+//
+// Smallest controller transfer limit honoured; anything below cannot
+// carry a register address plus a useful payload.
+//
+
+#define SPB_MIN_TRANSFER_SIZE         8
+
+typedef enum _SPB_PRIORITY
+{
+	SpbPriorityBackground = 0,
+	SpbPriorityMessage
+} SPB_PRIORITY;
+
 //
 // SPB (I2C) context
 //
@@ -37,6 +70,18 @@ typedef struct _SPB_CONTEXT
 	WDFMEMORY WriteMemory;
 	WDFMEMORY ReadMemory;
 	WDFWAITLOCK SpbLock;
+
+	ULONG RetryBudget;
+	volatile LONG RetryCount;
+	volatile LONG RetryRecovered;
+	volatile LONG RetryExhausted;
+
+	volatile LONG MessageWaiters;
+
+	//
+	// Largest single transfer the I2C controller accepts, 0 for no limit
+	//
+	ULONG MaxTransferSize;
 } SPB_CONTEXT;
 
 NTSTATUS
@@ -52,7 +97,8 @@ SpbReadDataSynchronously16(
 	_In_ SPB_CONTEXT *SpbContext,
 	_In_ UINT16 Address,
 	_In_reads_bytes_(Length) PVOID Data,
-	_In_ ULONG Length
+	_In_ ULONG Length,
+	_In_ SPB_PRIORITY Priority
 	);
 
 VOID